@@ -0,0 +1,160 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Measures time spent by RangeFinder tracing its beams with 1, 2, 4 and 8
+ * threads and then again with 2 threads (i.e., with fewer threads than
+ * there are already created workers).
+ *
+ * usage: bench_rangefinder [num_beams] [steps] [num_obstacles]
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <sim/sim.hpp>
+#include <sim/msg.hpp>
+#include <sim/sensor/rangefinder.hpp>
+
+using sim::Scalar;
+using sim::Vec3;
+using sim::Quat;
+using sim::Time;
+using namespace std;
+
+
+/**
+ * Range finder that traces all beams every step and measures time of it.
+ */
+class BenchRangeFinder : public sim::sensor::RangeFinder {
+  public:
+    unsigned long total_us;
+    unsigned long scans;
+
+    BenchRangeFinder(Scalar max_range, size_t num_beams, Scalar angle_range)
+        : RangeFinder(max_range, num_beams, angle_range),
+          total_us(0), scans(0)
+    {}
+
+    void reset() { total_us = 0; scans = 0; }
+
+    void cbPreStep()
+    {
+        sim::Timer timer;
+
+        // don't let range finder reuse previous scan
+        _data_valid = false;
+
+        timer.start();
+        RangeFinder::cbPreStep();
+        total_us += timer.stop().inUs();
+        ++scans;
+    }
+};
+
+class S : public sim::Sim {
+  public:
+    BenchRangeFinder *rf;
+
+    S(size_t num_beams, size_t num_obstacles)
+        : Sim()
+    {
+        sim::WorldODE *w = sim::WorldFactory::ODE();
+
+        setTimeStep(Time::fromMs(20));
+        setTimeSubSteps(2);
+        setSimulateReal(false);
+
+        setWorld(w);
+        visWorld()->setWindow(false);
+
+        createArena(num_obstacles);
+
+        rf = new BenchRangeFinder(10., num_beams, 2. * M_PI);
+        rf->setPosRot(Vec3(0., 0., 0.2));
+        addComponent(rf);
+    }
+
+    void createArena(size_t num_obstacles)
+    {
+        sim::Body *c;
+        Scalar x, y;
+
+        c = world()->createBodyCompound();
+        c->addBox(Vec3(20., 20., 0.1));
+
+        srand(1);
+        for (size_t i = 0; i < num_obstacles; i++){
+            x = 18. * (rand() / (Scalar)RAND_MAX) - 9.;
+            y = 18. * (rand() / (Scalar)RAND_MAX) - 9.;
+            c->addBox(Vec3(.2, .2, .5), SIM_BODY_DEFAULT_VIS, Vec3(x, y, .25),
+                      Quat(Vec3(0., 0., 1.), x * y));
+        }
+        c->activate();
+    }
+
+    void stepWorld()
+    {
+        _stepWorld();
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    size_t num_beams = 360, steps = 500, num_obstacles = 500;
+    size_t threads[] = { 1, 2, 4, 8, 2 };
+    double base = 0.;
+
+    if (argc > 1)
+        num_beams = atoi(argv[1]);
+    if (argc > 2)
+        steps = atoi(argv[2]);
+    if (argc > 3)
+        num_obstacles = atoi(argv[3]);
+
+    S s(num_beams, num_obstacles);
+    s.init();
+
+    cout << "# beams: " << num_beams << ", steps: " << steps
+         << ", obstacles: " << num_obstacles << endl;
+    cout << "# threads  us/scan  speedup" << endl;
+
+    for (size_t i = 0; i < sizeof(threads) / sizeof(size_t); i++){
+        s.rf->setNumThreads(threads[i]);
+
+        // warm up (creates worker threads)
+        for (size_t j = 0; j < 10; j++)
+            s.stepWorld();
+
+        s.rf->reset();
+        for (size_t j = 0; j < steps; j++)
+            s.stepWorld();
+
+        double us = s.rf->total_us / (double)s.rf->scans;
+        if (i == 0)
+            base = us;
+
+        cout << threads[i] << " " << us << " " << (base / us) << endl;
+    }
+
+    s.finish();
+
+    return 0;
+}
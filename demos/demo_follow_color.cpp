@@ -32,6 +32,7 @@ using sim::Time;
 using namespace std;
 
 static bool dump = false;
+static bool headless = false;
 
 class Leader : public sim::comp::Syrotek {
   public:
@@ -161,6 +162,11 @@ class S : public sim::Sim {
         setTimeStep(Time::fromMs(20));
         setTimeSubSteps(2);
 
+        if (headless){
+            setHeadless();
+            setSimulateReal(false);
+        }
+
         setWorld(w);
 
         w->setCFM(0.0001);
@@ -269,9 +275,11 @@ class S : public sim::Sim {
 
 int main(int argc, char *argv[])
 {
-    if (argc > 1){
-        if (strcmp(argv[1], "--dump") == 0)
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--dump") == 0)
             dump = true;
+        if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
     }
 
     S s;
@@ -43,6 +43,7 @@ SSSA *active = 0;
 class SSSA : public sim::comp::SSSA {
     uint16_t _id;
     sim::Sim *_sim;
+    sim::comp::RServer *_server;
     sim::sensor::RangeFinder *_rf;
     bool _rf_added;
     sim::sensor::Camera *_cam;
@@ -50,11 +51,13 @@ class SSSA : public sim::comp::SSSA {
 
   public:
     SSSA(uint16_t id, const Vec3 &pos, const Quat &rot = Quat(0., 0., 0., 1.))
-        : sim::comp::SSSA(pos, rot), _id(id), _rf(NULL), _rf_added(false),
+        : sim::comp::SSSA(pos, rot), _id(id), _server(NULL),
+                                     _rf(NULL), _rf_added(false),
                                      _cam(NULL), _cam_added(false)
     {
         _rf = new sim::sensor::RangeFinder(50, 10, M_PI);
         _cam = new sim::sensor::Camera();
+        _cam->setFormat(sim::sensor::Camera::FORMAT_BGR8);
     }
 
     ~SSSA()
@@ -69,14 +72,8 @@ class SSSA : public sim::comp::SSSA {
     {
         sim::comp::SSSA::init(sim);
         sim->regMessage(this, sim::MessageKeyPressed::Type);
-        DBG("");
-        sim->regMessage(this, sim::comp::RMessageInPing::Type);
-        sim->regMessage(this, sim::comp::RMessageInGetPos::Type);
-        sim->regMessage(this, sim::comp::RMessageInGetRot::Type);
-        sim->regMessage(this, sim::comp::RMessageInSetVelLeft::Type);
-        sim->regMessage(this, sim::comp::RMessageInSetVelRight::Type);
-        sim->regMessage(this, sim::comp::RMessageInGetRF::Type);
-        sim->regMessage(this, sim::comp::RMessageInGetImg::Type);
+        // remote requests are passed directly by RServer (see
+        // S::createRobot())
 
         if (_id == 10){
             _rf->attachToBody(robot()->chasis(), sim::Vec3(0.55, 0, -0.3));
@@ -95,6 +92,8 @@ class SSSA : public sim::comp::SSSA {
         _sim = sim;
     }
 
+    void setServer(sim::comp::RServer *server) { _server = server; }
+
     void processMessage(const sim::Message &msg)
     {
         float vel;
@@ -105,17 +104,17 @@ class SSSA : public sim::comp::SSSA {
             DBG("ID: " << rmsg->msgID() << ", type: " << (int)rmsg->msgType());
 
             if (rmsg->type() == sim::comp::RMessageInPing::Type){
-                _sim->sendMessage(new sim::comp::RMessageOutPong(rmsg->msgID()));
+                _server->sendReply(new sim::comp::RMessageOutPong(rmsg->msgID()));
 
             }else if (rmsg->type() == sim::comp::RMessageInGetPos::Type){
                 const sim::Vec3 &pos = robot()->pos();
                 DBG("  -- GetPos: " << pos.x() << " " << pos.y() << " " << pos.z());
-                _sim->sendMessage(new sim::comp::RMessageOutPos(_id, pos));
+                _server->sendReply(new sim::comp::RMessageOutPos(_id, pos));
 
             }else if (rmsg->type() == sim::comp::RMessageInGetRot::Type){
                 const sim::Quat &rot = robot()->rot();
                 DBG("  -- GetRot: " << rot.x() << " " << rot.y() << " " << rot.z() << " " << rot.w());
-                _sim->sendMessage(new sim::comp::RMessageOutRot(_id, rot));
+                _server->sendReply(new sim::comp::RMessageOutRot(_id, rot));
 
             }else if (rmsg->type() == sim::comp::RMessageInSetVelLeft::Type){
                 vel = ((sim::comp::RMessageInSetVelLeft *)rmsg)->msgVel();
@@ -133,10 +132,10 @@ class SSSA : public sim::comp::SSSA {
                 for (i = 0; i < _rf->numBeams(); i++){
                     DBG("    >> " << _rf->distance(i));
                 }
-                _sim->sendMessage(new sim::comp::RMessageOutRF(_id, *_rf));
+                _server->sendReply(new sim::comp::RMessageOutRF(_id, *_rf));
 
             }else if (rmsg->type() == sim::comp::RMessageInGetImg::Type){
-                _sim->sendMessage(new sim::comp::RMessageOutImg(_id, *_cam));
+                _server->sendReply(new sim::comp::RMessageOutImg(_id, *_cam));
             }
 
         }else if (msg.type() == sim::MessageKeyPressed::Type){
@@ -283,6 +282,8 @@ class S : public sim::Sim {
     S()
         : Sim()
     {
+        sim::comp::RServer *server;
+
         if (use_ode){
             initODE();
         }else{
@@ -294,11 +295,13 @@ class S : public sim::Sim {
 
         pauseSimulation();
 
+        server = new sim::comp::RServer("any", 9876);
+
         createArena();
-        createRobot();
+        createRobot(server);
 
         DBG("");
-        addComponent(new sim::comp::RServer("any", 9876));
+        addComponent(server);
     }
 
     void initBullet()
@@ -361,21 +364,29 @@ class S : public sim::Sim {
         c->activate();
     }
 
-    void createRobot()
+    void createRobot(sim::comp::RServer *server)
     {
         SSSA *rob;
 
         rob = new SSSA(10, Vec3(2., 2., .6));
         addComponent(rob);
+        rob->setServer(server);
+        server->regEndpoint(10, rob);
 
         rob = new SSSA(11, Vec3(.746, 2., .6));
         addComponent(rob);
+        rob->setServer(server);
+        server->regEndpoint(11, rob);
 
         rob = new SSSA(12, Vec3(2., 3.254, .6), Quat(Vec3(0., 0., 1.), M_PI / 2.));
         addComponent(rob);
+        rob->setServer(server);
+        server->regEndpoint(12, rob);
 
         rob = new SSSA(13, Vec3(2., 0.746, .6), Quat(Vec3(0., 0., 1.), -M_PI / 2.));
         addComponent(rob);
+        rob->setServer(server);
+        server->regEndpoint(13, rob);
 
         // and as last add component which will connect all robots
         addComponent(new RobotsManager());
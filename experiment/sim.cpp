@@ -1,3 +1,4 @@
+#include <map>
 #include "sim.hpp"
 #include "arena.hpp"
 
@@ -103,19 +104,39 @@ void Sim::init()
 
 void Sim::connectRobots()
 {
-    std::list<Robot *>::iterator it, it2, it_end;
-
-    it = it2 = _robots.begin();
+    // maximal distance of arm's ball from other robot's chasis - socket
+    // lies on chasis, so chasis farther than this can't be connected to
+    const sim::Scalar max_dist = SIM_ROBOT_SSSA_CONNECT_DIST;
+    std::map<const sim::Body *, Robot *> chasis;
+    std::map<const sim::Body *, Robot *>::iterator cit;
+    std::list<Robot *>::iterator it, it_end;
+    std::list<sim::Body *> near;
+    std::list<sim::Body *>::iterator nit;
+    Vec3 pos, dir, up;
+
+    it = _robots.begin();
     it_end = _robots.end();
     for (; it != it_end; ++it){
-        it2 = it;
-        for (++it2; it2 != it_end; ++it2){
-            if (!(*it)->robot() || !(*it2)->robot())
+        if ((*it)->robot())
+            chasis[(*it)->robot()->chasis()] = *it;
+    }
+
+    // connect each robot to robots whose chasis is near its ball -
+    // broadphase of world is used instead of testing all pairs
+    for (it = _robots.begin(); it != it_end; ++it){
+        if (!(*it)->robot())
+            continue;
+
+        (*it)->robot()->ballSetup(&pos, &dir, &up);
+
+        near.clear();
+        world()->querySphere(pos, max_dist, &near);
+        for (nit = near.begin(); nit != near.end(); ++nit){
+            cit = chasis.find(*nit);
+            if (cit == chasis.end() || cit->second == *it)
                 continue;
 
-            if (!(*it)->robot()->connectTo(*(*it2)->robot())){
-                (*it2)->robot()->connectTo(*(*it)->robot());
-            }
+            (*it)->robot()->connectTo(*cit->second->robot());
         }
     }
 }
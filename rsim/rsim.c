@@ -24,20 +24,74 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
 #include "rsim.h"
+#include "shm.h"
 
 static int rsimReadByte(rsim_t *c, char *b);
 static int rsimReadID(rsim_t *c, uint16_t *id);
 static int rsimReadType(rsim_t *c, char *type);
 static int rsimReadUInt16(rsim_t *c, uint16_t *i);
+static int rsimReadUInt32(rsim_t *c, uint32_t *i);
 static int rsimReadFloat(rsim_t *c, float *f);
 
 static int rsimWriteFloat(rsim_t *c, float f);
 
+static ssize_t rsimRead(rsim_t *c, void *buf, size_t len);
+static int rsimReadData(rsim_t *c, void *buf, size_t len);
+static int rsimWrite(rsim_t *c, const void *buf, size_t len);
+
+static int rsimConnectUnix(rsim_t *c, const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "too long path of unix socket\n");
+        return -1;
+    }
+
+    c->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (c->sock < 0){
+        perror("cannot create socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (connect(c->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        perror("connect failed");
+        close(c->sock);
+        return -1;
+    }
+
+    return 0;
+}
+
 int rsimConnect(rsim_t *c, const char *ipaddr, uint16_t port)
 {
     struct sockaddr_in addr;
-    int res;
+    int res, opt;
+
+    c->bufstart = c->bufend = 0;
+    c->msg = NULL;
+    c->shm = NULL;
+    c->sock = -1;
+
+    if (strncmp(ipaddr, "shm://", 6) == 0){
+        c->shm = (rsim_shm_t *)malloc(sizeof(rsim_shm_t));
+        if (rsimShmOpen(c->shm, ipaddr + 6) != 0){
+            free(c->shm);
+            c->shm = NULL;
+            return -1;
+        }
+        return 0;
+    }
+
+    if (strncmp(ipaddr, "unix:", 5) == 0)
+        return rsimConnectUnix(c, ipaddr + 5);
 
     c->sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (c->sock < 0){
@@ -66,8 +120,10 @@ int rsimConnect(rsim_t *c, const char *ipaddr, uint16_t port)
         return -1;
     }
 
-    c->bufstart = c->bufend = 0;
-    c->msg = NULL;
+    // requests are small and often waited for (e.g., in lockstep), so
+    // they shouldn't be delayed by Nagle's algorithm
+    opt = 1;
+    setsockopt(c->sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
 
     return 0;
 }
@@ -76,7 +132,14 @@ void rsimClose(rsim_t *c)
 {
     if (c->msg)
         free(c->msg);
-    close(c->sock);
+
+    if (c->shm){
+        rsimShmClose(c->shm);
+        free(c->shm);
+        c->shm = NULL;
+    }else{
+        close(c->sock);
+    }
 }
 
 int rsimHaveMsg(rsim_t *c)
@@ -85,6 +148,11 @@ int rsimHaveMsg(rsim_t *c)
     int ready, maxfd;
     struct timeval timeout;
 
+    if (c->bufstart != c->bufend)
+        return 1;
+    if (c->shm)
+        return rsimShmHaveData(c->shm);
+
     FD_ZERO(&fds);
     FD_SET(c->sock, &fds);
     timeout.tv_sec = 0;
@@ -105,6 +173,8 @@ const rsim_msg_t *rsimNextMsg(rsim_t *c)
     rsim_msg_float4_t *msgf4;
     rsim_msg_floats_t *msgfs;
     rsim_msg_img_t *msgimg;
+    rsim_msg_batch_t *msgbatch;
+    rsim_msg_step_t *msgstep;
 
     if (c->msg){
         free(c->msg);
@@ -179,14 +249,32 @@ const rsim_msg_t *rsimNextMsg(rsim_t *c)
         msgimg->data = (unsigned char *)(((char *)msgimg) + sizeof(rsim_msg_img_t));
 
         slen = 3 * height * width;
-        for (i = 0; i < slen; i++){
-            if (rsimReadByte(c, (char *)(msgimg->data + i)) != 0){
-                free(msgimg);
-                return NULL;
-            }
+        if (rsimReadData(c, msgimg->data, slen) != 0){
+            free(msgimg);
+            return NULL;
         }
 
         c->msg = (rsim_msg_t *)msgimg;
+
+    }else if (type == RSIM_MSG_BATCH){
+        msgbatch = (rsim_msg_batch_t *)malloc(sizeof(rsim_msg_batch_t));
+
+        if (rsimReadUInt16(c, &msgbatch->count) != 0){
+            free(msgbatch);
+            return NULL;
+        }
+
+        c->msg = (rsim_msg_t *)msgbatch;
+
+    }else if (type == RSIM_MSG_STEP){
+        msgstep = (rsim_msg_step_t *)malloc(sizeof(rsim_msg_step_t));
+
+        if (rsimReadUInt32(c, &msgstep->step) != 0){
+            free(msgstep);
+            return NULL;
+        }
+
+        c->msg = (rsim_msg_t *)msgstep;
     }else{
         c->msg = (rsim_msg_t *)malloc(sizeof(rsim_msg_t));
     }
@@ -199,25 +287,98 @@ const rsim_msg_t *rsimNextMsg(rsim_t *c)
 
 int rsimSendSimple(rsim_t *c, uint16_t id, char type)
 {
-    ssize_t size;
+    char msg[3];
 
     id = htons(id);
-    size = write(c->sock, (void *)&id, sizeof(uint16_t));
-    if (size != sizeof(uint16_t))
+    memcpy(msg, &id, 2);
+    msg[2] = type;
+
+    return rsimWrite(c, msg, 3);
+}
+
+int rsimSendFloat(rsim_t *c, uint16_t id, char type, float f)
+{
+    if (rsimSendSimple(c, id, type) != 0)
         return -1;
+    return rsimWriteFloat(c, f);
+}
+
+int rsimSubscribe(rsim_t *c, uint16_t id, char type, uint16_t period)
+{
+    char msg[6];
 
-    size = write(c->sock, (void *)&type, sizeof(char));
-    if (size != sizeof(char))
+    id = htons(id);
+    period = htons(period);
+
+    memcpy(msg, &id, 2);
+    msg[2] = RSIM_MSG_SUBSCRIBE;
+    msg[3] = type;
+    memcpy(msg + 4, &period, 2);
+
+    return rsimWrite(c, msg, 6);
+}
+
+int rsimStepDone(rsim_t *c, uint32_t step)
+{
+    char msg[7];
+
+    memset(msg, 0, 2);
+    msg[2] = RSIM_MSG_STEP_DONE;
+    step = htonl(step);
+    memcpy(msg + 3, &step, 4);
+
+    return rsimWrite(c, msg, 7);
+}
+
+void rsimBatchInit(rsim_batch_t *b)
+{
+    b->len = 0;
+    b->count = 0;
+}
+
+int rsimBatchAddSimple(rsim_batch_t *b, uint16_t id, char type)
+{
+    if (b->len + 3 > RSIM_BUFSIZE - 5)
         return -1;
 
+    id = htons(id);
+    memcpy(b->buf + 5 + b->len, &id, 2);
+    b->buf[5 + b->len + 2] = type;
+    b->len += 3;
+    b->count++;
+
     return 0;
 }
 
-int rsimSendFloat(rsim_t *c, uint16_t id, char type, float f)
+int rsimBatchAddFloat(rsim_batch_t *b, uint16_t id, char type, float f)
 {
-    if (rsimSendSimple(c, id, type) != 0)
+    uint32_t i;
+
+    if (b->len + 7 > RSIM_BUFSIZE - 5)
         return -1;
-    return rsimWriteFloat(c, f);
+
+    rsimBatchAddSimple(b, id, type);
+
+    memcpy(&i, &f, 4);
+    i = htonl(i);
+    memcpy(b->buf + 5 + b->len, &i, 4);
+    b->len += 4;
+
+    return 0;
+}
+
+int rsimSendBatch(rsim_t *c, rsim_batch_t *b, uint16_t id)
+{
+    uint16_t count;
+
+    // header is written in front of requests
+    id = htons(id);
+    count = htons(b->count);
+    memcpy(b->buf, &id, 2);
+    b->buf[2] = RSIM_MSG_BATCH;
+    memcpy(b->buf + 3, &count, 2);
+
+    return rsimWrite(c, b->buf, b->len + 5);
 }
 
 
@@ -226,7 +387,7 @@ static int rsimReadByte(rsim_t *c, char *b)
     ssize_t readsize;
 
     if (c->bufstart == c->bufend){
-        readsize = read(c->sock, c->buf, RSIM_BUFSIZE);
+        readsize = rsimRead(c, c->buf, RSIM_BUFSIZE);
         if (readsize <= 0)
             return -1;
 
@@ -258,6 +419,20 @@ static int rsimReadUInt16(rsim_t *c, uint16_t *id)
     return 0;
 }
 
+static int rsimReadUInt32(rsim_t *c, uint32_t *i)
+{
+    char *ci = (char *)i;
+    int j;
+
+    for (j = 0; j < 4; j++){
+        if (rsimReadByte(c, ci + j) != 0)
+            return -1;
+    }
+
+    *i = ntohl(*i);
+    return 0;
+}
+
 static int rsimReadType(rsim_t *c, char *type)
 {
     return rsimReadByte(c, type);
@@ -290,7 +465,6 @@ static int rsimReadFloat(rsim_t *r, float *f)
 
 static int rsimWriteFloat(rsim_t *r, float f)
 {
-    ssize_t size;
     uint32_t i;
     char *c, *cf;
 
@@ -302,8 +476,52 @@ static int rsimWriteFloat(rsim_t *r, float f)
     c[3] = cf[3];
     i = htonl(i);
 
-    size = write(r->sock, (void *)&i, 4);
-    if (size != 4)
+    return rsimWrite(r, &i, 4);
+}
+
+static ssize_t rsimRead(rsim_t *c, void *buf, size_t len)
+{
+    if (c->shm)
+        return rsimShmRead(c->shm, buf, len);
+    return read(c->sock, buf, len);
+}
+
+static int rsimReadData(rsim_t *c, void *_buf, size_t len)
+{
+    char *buf = (char *)_buf;
+    size_t size;
+    ssize_t readsize;
+
+    // first use already buffered data
+    size = c->bufend - c->bufstart;
+    if (size > len)
+        size = len;
+    memcpy(buf, c->bufstart, size);
+    c->bufstart += size;
+    buf += size;
+    len -= size;
+
+    // rest is read directly
+    while (len > 0){
+        readsize = rsimRead(c, buf, len);
+        if (readsize <= 0)
+            return -1;
+        buf += readsize;
+        len -= readsize;
+    }
+
+    return 0;
+}
+
+static int rsimWrite(rsim_t *c, const void *buf, size_t len)
+{
+    ssize_t size;
+
+    if (c->shm)
+        return rsimShmWrite(c->shm, buf, len);
+
+    size = write(c->sock, buf, len);
+    if (size != (ssize_t)len)
         return -1;
     return 0;
 }
@@ -40,6 +40,10 @@
 #define RSIM_MSG_RF            10
 #define RSIM_MSG_GET_IMG       11
 #define RSIM_MSG_IMG           12
+#define RSIM_MSG_SUBSCRIBE     13
+#define RSIM_MSG_BATCH         14
+#define RSIM_MSG_STEP_DONE     15
+#define RSIM_MSG_STEP          16
 
 struct _rsim_msg_t {
     uint16_t id;
@@ -100,9 +104,45 @@ struct _rsim_msg_img_t {
 typedef struct _rsim_msg_img_t rsim_msg_img_t;
 
 
+/**
+ * Header of batch reply. It is followed by .count messages which are
+ * returned by next calls of rsimNextMsg().
+ */
+struct _rsim_msg_batch_t {
+    uint16_t id;
+    char type;
+    uint16_t count;
+};
+typedef struct _rsim_msg_batch_t rsim_msg_batch_t;
+
+/**
+ * End of simulation step sent by server in lockstep mode (see
+ * rsimStepDone()). All replies produced in the step precede it.
+ */
+struct _rsim_msg_step_t {
+    uint16_t id;
+    char type;
+    uint32_t step;
+};
+typedef struct _rsim_msg_step_t rsim_msg_step_t;
+
+/**
+ * Batch of requests sent at once by rsimSendBatch().
+ */
+struct _rsim_batch_t {
+    char buf[RSIM_BUFSIZE];
+    size_t len;
+    uint16_t count;
+};
+typedef struct _rsim_batch_t rsim_batch_t;
+
+
+struct _rsim_shm_t;
 
 struct _rsim_t {
     int sock;
+    struct _rsim_shm_t *shm; /*!< Shared memory transport, NULL if socket
+                                  is used */
 
     char buf[RSIM_BUFSIZE];
     char *bufstart, *bufend;
@@ -112,6 +152,10 @@ typedef struct _rsim_t rsim_t;
 
 /**
  * Connects client to specified server:port and id of robot.
+ * If addr is in form "unix:/path" client connects to unix domain socket
+ * (see RServer::addUnix()) and if it is in form "shm://name" client
+ * attaches to shared memory segment of that name created by
+ * RServer::addShm(). Port is ignored in both cases.
  * Returns 0 on success, -1 if server is not reachable or other client is
  * already registered to specified robot.
  */
@@ -146,4 +190,59 @@ int rsimSendSimple(rsim_t *, uint16_t id, char type);
  */
 int rsimSendFloat(rsim_t *, uint16_t id, char type, float f);
 
+/**
+ * Subscribes to stream of replies to request of given type
+ * (RSIM_MSG_GET_POS, RSIM_MSG_GET_ROT, RSIM_MSG_GET_RF or RSIM_MSG_GET_IMG).
+ * Server then sends the reply every period steps without being asked.
+ * Zero period cancels the subscription.
+ * Reply describing state after step N is sent right after the step, so in
+ * lockstep it is received before RSIM_MSG_STEP of step N.
+ */
+int rsimSubscribe(rsim_t *, uint16_t id, char type, uint16_t period);
+
+/**
+ * Tells server running in lockstep mode (see RServer::setLockstep()) that
+ * client is done with given step, i.e., all requests for the step were
+ * sent. Server doesn't perform the next step until all clients in
+ * lockstep are done.
+ *
+ * First call joins client to lockstep (step is ignored then). After that
+ * client should wait for RSIM_MSG_STEP (see rsim_msg_step_t) and answer
+ * it with the same step number. Requests sent in between are answered
+ * while server waits, so client can wait for replies (e.g., RSIM_MSG_POS
+ * describing state after the step) before it calls rsimStepDone().
+ * By default, client that doesn't answer within 1 s is released from
+ * lockstep and joins it again by the next call.
+ */
+int rsimStepDone(rsim_t *, uint32_t step);
+
+
+/**
+ * Initializes empty batch of requests.
+ */
+void rsimBatchInit(rsim_batch_t *b);
+
+/**
+ * Adds simple request to batch.
+ * Returns -1 if batch is full.
+ */
+int rsimBatchAddSimple(rsim_batch_t *b, uint16_t id, char type);
+
+/**
+ * Adds request with one additional float to batch.
+ * Returns -1 if batch is full.
+ */
+int rsimBatchAddFloat(rsim_batch_t *b, uint16_t id, char type, float f);
+
+/**
+ * Sends all requests from batch in one message. All requests are handled
+ * by server in the same step and replies to them are sent back in one
+ * RSIM_MSG_BATCH message with given id (see rsim_msg_batch_t). More
+ * batches can be sent without waiting for replies, each is answered by
+ * its own RSIM_MSG_BATCH. Other messages (replies to requests sent
+ * outside a batch, subscribed streams, ...) are never part of it.
+ * Reply that doesn't come within a few steps is left out of the batch.
+ */
+int rsimSendBatch(rsim_t *, rsim_batch_t *b, uint16_t id);
+
 #endif /* _SIM_RSIM_H_ */
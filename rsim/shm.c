@@ -0,0 +1,207 @@
+/***
+ * Remote sim
+ * -----------
+ * Copyright (c)2011 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "shm.h"
+
+/** How long to sleep before checking whether server is still alive */
+#define RSIM_SHM_TIMEOUT_NS 100000000L
+
+static void rsimShmWait(volatile uint32_t *addr, uint32_t val)
+{
+    struct timespec ts;
+
+    ts.tv_sec  = 0;
+    ts.tv_nsec = RSIM_SHM_TIMEOUT_NS;
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+int rsimShmOpen(rsim_shm_t *s, const char *name)
+{
+    char path[256];
+    struct stat st;
+    void *mem;
+    int fd;
+
+    if (name[0] == '/'){
+        snprintf(path, sizeof(path), "%s", name);
+    }else{
+        snprintf(path, sizeof(path), "/%s", name);
+    }
+
+    fd = shm_open(path, O_RDWR, 0);
+    if (fd < 0){
+        perror("cannot open shm segment");
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(rsim_shm_hdr_t)){
+        fprintf(stderr, "invalid shm segment\n");
+        close(fd);
+        return -1;
+    }
+
+    mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED){
+        perror("cannot map shm segment");
+        return -1;
+    }
+
+    s->hdr = (rsim_shm_hdr_t *)mem;
+    s->len = st.st_size;
+    s->c2s = (char *)mem + sizeof(rsim_shm_hdr_t);
+    s->s2c = s->c2s + s->hdr->size;
+
+    if (s->hdr->magic != RSIM_SHM_MAGIC || !s->hdr->server
+            || s->hdr->size == 0
+            || (s->hdr->size & (s->hdr->size - 1)) != 0
+            || s->len < sizeof(rsim_shm_hdr_t) + 2 * (size_t)s->hdr->size){
+        fprintf(stderr, "no server on shm segment\n");
+        munmap(mem, s->len);
+        return -1;
+    }
+
+    // only one client can be attached
+    if (!__sync_bool_compare_and_swap(&s->hdr->client, 0, 2)){
+        fprintf(stderr, "other client is already attached\n");
+        munmap(mem, s->len);
+        return -1;
+    }
+
+    // server detaches us if we die without rsimShmClose()
+    s->hdr->client_pid = getpid();
+
+    // server resets rings at the beginning of its next step
+    while (s->hdr->client == 2 && s->hdr->server){
+        rsimShmWait(&s->hdr->client, 2);
+    }
+
+    if (s->hdr->client != 1){
+        fprintf(stderr, "server didn't accept client\n");
+        munmap(mem, s->len);
+        return -1;
+    }
+
+    return 0;
+}
+
+void rsimShmClose(rsim_shm_t *s)
+{
+    s->hdr->client_pid = 0;
+    __sync_bool_compare_and_swap(&s->hdr->client, 1, 0);
+    munmap(s->hdr, s->len);
+}
+
+ssize_t rsimShmRead(rsim_shm_t *s, void *buf, size_t len)
+{
+    rsim_shm_ring_t *r = &s->hdr->s2c;
+    uint32_t head, tail, size, pos, avail;
+
+    size = s->hdr->size;
+    tail = r->tail;
+
+    while ((head = r->head) == tail){
+        if (!s->hdr->server || s->hdr->client != 1)
+            return -1;
+
+        r->head_wait = 1;
+        __sync_synchronize();
+        if (r->head == tail)
+            rsimShmWait(&r->head, tail);
+        r->head_wait = 0;
+    }
+    __sync_synchronize();
+
+    avail = head - tail;
+    if (len > avail)
+        len = avail;
+
+    pos = tail & (size - 1);
+    if (pos + len > size){
+        memcpy(buf, s->s2c + pos, size - pos);
+        memcpy((char *)buf + (size - pos), s->s2c, len - (size - pos));
+    }else{
+        memcpy(buf, s->s2c + pos, len);
+    }
+
+    __sync_synchronize();
+    r->tail = tail + len;
+
+    return len;
+}
+
+int rsimShmWrite(rsim_shm_t *s, const void *_buf, size_t len)
+{
+    rsim_shm_ring_t *r = &s->hdr->c2s;
+    const char *buf = (const char *)_buf;
+    uint32_t head, tail, size, pos, free, chunk;
+
+    size = s->hdr->size;
+    head = r->head;
+
+    while (len > 0){
+        while ((tail = r->tail) + size == head){
+            if (!s->hdr->server || s->hdr->client != 1)
+                return -1;
+
+            r->tail_wait = 1;
+            __sync_synchronize();
+            if (r->tail + size == head)
+                rsimShmWait(&r->tail, tail);
+            r->tail_wait = 0;
+        }
+
+        free = size - (head - tail);
+        chunk = (len < free ? len : free);
+
+        pos = head & (size - 1);
+        if (pos + chunk > size){
+            memcpy(s->c2s + pos, buf, size - pos);
+            memcpy(s->c2s, buf + (size - pos), chunk - (size - pos));
+        }else{
+            memcpy(s->c2s + pos, buf, chunk);
+        }
+
+        // server polls requests every step, no need to wake it up
+        __sync_synchronize();
+        head += chunk;
+        r->head = head;
+
+        buf += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+int rsimShmHaveData(rsim_shm_t *s)
+{
+    return s->hdr->s2c.head != s->hdr->s2c.tail;
+}
@@ -0,0 +1,97 @@
+/***
+ * Remote sim
+ * -----------
+ * Copyright (c)2011 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_RSIM_SHM_H_
+#define _SIM_RSIM_SHM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define RSIM_SHM_MAGIC 0x53494d52
+
+/**
+ * Single producer single consumer ring in shared memory.
+ * Note that this must be synchronized with /src/comp/rserver_shm.hpp!!
+ */
+struct _rsim_shm_ring_t {
+    volatile uint32_t head; /*!< Written by producer */
+    volatile uint32_t head_wait; /*!< Consumer sleeps on head */
+    char _pad1[56];
+    volatile uint32_t tail; /*!< Written by consumer */
+    volatile uint32_t tail_wait; /*!< Producer sleeps on tail */
+    char _pad2[56];
+};
+typedef struct _rsim_shm_ring_t rsim_shm_ring_t;
+
+/**
+ * Header of shared memory segment.
+ * Note that this must be synchronized with /src/comp/rserver_shm.hpp!!
+ */
+struct _rsim_shm_hdr_t {
+    uint32_t magic;
+    uint32_t size; /*!< Size of data of each ring (power of two) */
+    volatile uint32_t server; /*!< 1 while server is running */
+    volatile uint32_t client; /*!< 0 - no client, 2 - attaching,
+                                   1 - attached */
+    volatile uint32_t client_pid; /*!< PID of client, 0 if unknown */
+    char _pad[44];
+    rsim_shm_ring_t c2s; /*!< Client to server */
+    rsim_shm_ring_t s2c; /*!< Server to client */
+};
+typedef struct _rsim_shm_hdr_t rsim_shm_hdr_t;
+
+struct _rsim_shm_t {
+    rsim_shm_hdr_t *hdr;
+    size_t len; /*!< Length of mapped segment */
+    char *c2s, *s2c; /*!< Data of rings */
+};
+typedef struct _rsim_shm_t rsim_shm_t;
+
+/**
+ * Attaches to shared memory segment created by server.
+ * Returns 0 on success.
+ */
+int rsimShmOpen(rsim_shm_t *s, const char *name);
+
+/**
+ * Detaches from segment.
+ */
+void rsimShmClose(rsim_shm_t *s);
+
+/**
+ * Reads at most len bytes, blocks until at least one byte is available.
+ * Returns number of read bytes or -1 if server is gone.
+ */
+ssize_t rsimShmRead(rsim_shm_t *s, void *buf, size_t len);
+
+/**
+ * Writes all len bytes, blocks while ring is full.
+ * Returns 0 on success.
+ */
+int rsimShmWrite(rsim_shm_t *s, const void *buf, size_t len);
+
+/**
+ * Returns true if there are some data to read.
+ */
+int rsimShmHaveData(rsim_shm_t *s);
+
+#endif /* _SIM_RSIM_SHM_H_ */
@@ -19,10 +19,6 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <BulletCollision/CollisionShapes/btBoxShape.h>
-#include <BulletCollision/CollisionShapes/btSphereShape.h>
-#include <BulletCollision/CollisionShapes/btCylinderShape.h>
-#include <BulletCollision/CollisionShapes/btTriangleMesh.h>
 #include <osg/ShapeDrawable>
 
 #include "sim/bullet/body.hpp"
@@ -60,7 +56,8 @@ Body::Body(World *w)
     : sim::Body(),
       _world(w), _body(0),
       _next_id(1), _mass(0), _local_inertia(0., 0., 0.),
-      _damping_lin(0.2), _damping_ang(0.2)
+      _damping_lin(0.2), _damping_ang(0.2),
+      _force_awake(false)
 {
     _shape = new btCompoundShape;
     _motion_state = new BodyMotionState(this);
@@ -69,12 +66,9 @@ Body::Body(World *w)
 Body::~Body()
 {
     for_each(_shapes_it_t, _shapes){
+        // shapes are owned by world's cache
         if (it->second->vis)
             delete it->second->vis;
-
-        _shape->removeChildShape(it->second->shape);
-        delete it->second->shape;
-
         delete it->second;
     }
     _shapes.clear();
@@ -83,6 +77,7 @@ Body::~Body()
         delete _body;
     if (_motion_state)
         delete _motion_state;
+    delete _shape;
 }
 
 int Body::addCube(Scalar w, VisBody *vis,
@@ -94,7 +89,7 @@ int Body::addCube(Scalar w, VisBody *vis,
 int Body::addBox(const Vec3 &dim, VisBody *vis,
                          const Vec3 &pos, const Quat &rot)
 {
-    btCollisionShape *shape = new btBoxShape(vToBt(dim / 2));
+    btCollisionShape *shape = _world->shapeCache()->box(dim);
 
     if (vis == SIM_BODY_DEFAULT_VIS)
         vis = new VisBodyBox(dim);
@@ -105,7 +100,7 @@ int Body::addBox(const Vec3 &dim, VisBody *vis,
 int Body::addSphere(Scalar radius, VisBody *vis,
                             const Vec3 &pos, const Quat &rot)
 {
-    btCollisionShape *shape = new btSphereShape(radius);
+    btCollisionShape *shape = _world->shapeCache()->sphere(radius);
 
     if (vis == SIM_BODY_DEFAULT_VIS)
         vis = new VisBodySphere(radius);
@@ -116,8 +111,7 @@ int Body::addSphere(Scalar radius, VisBody *vis,
 int Body::addCylinderZ(Scalar radius, Scalar height, VisBody *vis,
                             const Vec3 &pos, const Quat &rot)
 {
-    Vec3 v(radius, radius, height / 2.);
-    btCollisionShape *shape = new btCylinderShape(vToBt(v));
+    btCollisionShape *shape = _world->shapeCache()->cylinderZ(radius, height);
 
     if (vis == SIM_BODY_DEFAULT_VIS)
         vis = new VisBodyCylinder(radius, height);
@@ -143,19 +137,13 @@ int Body::addTriMesh(const sim::Vec3 *coords, size_t coords_len,
                              const unsigned int *ids, size_t ids_len,
                              VisBody *vis, const Vec3 &pos, const Quat &rot)
 {
-    btTriangleMesh *tris = new btTriangleMesh();
+    btCollisionShape *shape;
 
-    for (size_t i = 0; i < ids_len; i += 3){
-        tris->addTriangle(vToBt(coords[ids[i]]),
-                          vToBt(coords[ids[i + 1]]),
-                          vToBt(coords[ids[i + 2]]));
-    }
+    shape = _world->shapeCache()->triMesh(coords, coords_len, ids, ids_len);
 
     if (vis == SIM_BODY_DEFAULT_VIS)
         vis = new sim::VisBodyTriMesh(coords, coords_len, ids, ids_len);
 
-    btBvhTriangleMeshShape *shape = new btBvhTriangleMeshShape(tris, true);
-
     return _addShape(shape, vis, pos, rot);
 }
 
@@ -172,9 +160,8 @@ void Body::setMassBox(const Vec3 &dim, Scalar mass)
     if (!isZero(_mass)){
         btVector3 local_inertia(0,0,0);
 
-        btCollisionShape *shape = new btBoxShape(vToBt(dim / 2.));
+        btCollisionShape *shape = _world->shapeCache()->box(dim);
         shape->calculateLocalInertia(_mass, local_inertia);
-        delete shape;
 
         _local_inertia = vFromBt(local_inertia);
     }else{
@@ -189,9 +176,8 @@ void Body::setMassSphere(Scalar radius, Scalar mass)
     if (!isZero(_mass)){
         btVector3 local_inertia(0,0,0);
 
-        btCollisionShape *shape = new btSphereShape(radius);
+        btCollisionShape *shape = _world->shapeCache()->sphere(radius);
         shape->calculateLocalInertia(_mass, local_inertia);
-        delete shape;
 
         _local_inertia = vFromBt(local_inertia);
     }else{
@@ -206,10 +192,8 @@ void Body::setMassCylinder(Scalar radius, Scalar height, Scalar mass)
     if (!isZero(_mass)){
         btVector3 local_inertia(0,0,0);
 
-        Vec3 v(radius, radius, height / 2.);
-        btCollisionShape *shape = new btCylinderShape(vToBt(v));
+        btCollisionShape *shape = _world->shapeCache()->cylinderZ(radius, height);
         shape->calculateLocalInertia(_mass, local_inertia);
-        delete shape;
 
         _local_inertia = vFromBt(local_inertia);
     }else{
@@ -228,8 +212,15 @@ void Body::rmShape(int id)
     if (s->vis)
         delete s->vis;
 
-    _shape->removeChildShape(s->shape);
-    delete s->shape;
+    // Shape can be shared by more children (it is from cache), so only
+    // the child with matching transformation is removed.
+    for (int i = 0; i < _shape->getNumChildShapes(); i++){
+        if (_shape->getChildShape(i) == s->shape
+                && _shape->getChildTransform(i) == s->tr){
+            _shape->removeChildShapeByIndex(i);
+            break;
+        }
+    }
 
     delete s;
 
@@ -242,6 +233,7 @@ void Body::activate()
     _body->setUserPointer(this);
 
     _body->setDamping(_damping_lin, _damping_ang);
+    _applyAutoDisable();
 
     _applyPosRotToBt();
     _applyShapesToVis();
@@ -250,6 +242,9 @@ void Body::activate()
 
     if (_world->visWorld()){
         for_each(_shapes_it_t, _shapes){
+            if (!it->second->vis)
+                continue;
+            it->second->vis->setBody(this);
             _world->visWorld()->addBody(it->second->vis);
         }
     }
@@ -260,6 +255,35 @@ void Body::deactivate()
     /*TODO: _world->rmBody(this);*/
 }
 
+void Body::setForceAwake(bool yes)
+{
+    _force_awake = yes;
+    _applyAutoDisable();
+}
+
+bool Body::awake() const
+{
+    if (!_body)
+        return false;
+    return _body->isActive();
+}
+
+void Body::wakeUp()
+{
+    if (_body)
+        _body->activate(true);
+}
+
+void Body::sleep()
+{
+    if (!_body || _force_awake || !_world->autoDisable())
+        return;
+
+    _body->forceActivationState(ISLAND_SLEEPING);
+    _body->setLinearVelocity(btVector3(0., 0., 0.));
+    _body->setAngularVelocity(btVector3(0., 0., 0.));
+}
+
 
 
 VisBody *Body::visBody(int id)
@@ -345,6 +369,22 @@ void Body::_applyShapesToVis()
     }
 }
 
+void Body::_applyAutoDisable()
+{
+    if (!_body)
+        return;
+
+    _body->setSleepingThresholds(_world->autoDisableLinear(),
+                                 _world->autoDisableAngular());
+
+    if (_force_awake || !_world->autoDisable()){
+        _body->forceActivationState(DISABLE_DEACTIVATION);
+    }else if (_body->getActivationState() == DISABLE_DEACTIVATION){
+        _body->forceActivationState(ACTIVE_TAG);
+        _body->activate(true);
+    }
+}
+
 void Body::_applyPosRotToBt()
 {
     btTransform world;
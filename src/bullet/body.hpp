@@ -84,7 +84,10 @@ class Body : public sim::Body {
 
     Scalar _damping_lin, _damping_ang;
 
+    bool _force_awake; //!< True if body is never put asleep
+
     friend class BodyMotionState;
+    friend class World;
 
   public:
     Body(World *w);
@@ -104,6 +107,31 @@ class Body : public sim::Body {
     void setDampingLin(Scalar v) { _damping_lin = v; }
     void setDampingAng(Scalar v) { _damping_ang = v; }
 
+    /* \{ */
+    /**
+     * If set to true, body is never put asleep regardless of world's
+     * auto disable settings.
+     */
+    void setForceAwake(bool yes = true);
+    bool forceAwake() const { return _force_awake; }
+
+    /**
+     * Returns true if body is awake, i.e. it is simulated.
+     */
+    bool awake() const;
+
+    /**
+     * Wakes body up.
+     */
+    void wakeUp();
+
+    /**
+     * Puts body asleep. Body is woken up by first collision with an awake
+     * body. Force awake bodies can't be put asleep.
+     */
+    void sleep();
+    /* \} */
+
 
     /* \{ */
     /**
@@ -176,6 +204,11 @@ class Body : public sim::Body {
 
     void _applyShapesToVis();
     void _applyPosRotToBt();
+
+    /**
+     * Applies world's auto disable settings on btRigidBody.
+     */
+    void _applyAutoDisable();
 };
 
 class BodySimple : public Body {
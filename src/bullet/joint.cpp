@@ -150,7 +150,8 @@ void JointHinge2::paramLimitLoHi(double *lo, double *hi) const
 JointHinge::JointHinge(World *w, Body *oA, Body *oB, const Vec3 &anchor, const Vec3 &axis)
     : Joint(w, oA, oB),
       _anchor(anchor), _axis(axis),
-      _vel(0.), _fmax(0.)
+      _vel(0.), _fmax(0.),
+      _motor_idx(-1), _motor_dirty(false), _motor_on(false)
 {
     _lim[0] = -10000;
     _lim[1] = 10000;
@@ -192,6 +193,9 @@ void JointHinge::activate()
     Joint::activate();
 
     setParamLimitLoHi(_lim[0], _lim[1]);
+
+    if (_motor_idx >= 0)
+        _world->_motorChanged(this);
 }
 
 bool JointHinge::setParamLimitLoHi(double lo, double hi)
@@ -214,31 +218,41 @@ void JointHinge::paramLimitLoHi(double *lo, double *hi) const
 
 bool JointHinge::setParamVel(double vel)
 {
-    _vel = vel;
+    if (vel != _vel){
+        _vel = vel;
+        _world->_motorChanged(this);
+    }
     return true;
 }
 
 bool JointHinge::setParamFMax(double fmax)
 {
-    _fmax = fmax;
+    if (fmax != _fmax){
+        _fmax = fmax;
+        _world->_motorChanged(this);
+    }
     return true;
 }
 
-void JointHinge::_applyVelFMax(const sim::Time &time)
+void JointHinge::_applyVelFMax(Scalar time)
 {
     Scalar imp;
 
-    if (_joint){
-        //DBG(this << " " << _vel << " " << _fmax);
-        if (!isZero(_fmax) && !isZero(_vel)){
-            imp = _fmax * time.inSF();
-            //DBG(imp << " " << _fmax << " " << time.inSF());
-            ((btHingeConstraint *)_joint)->enableAngularMotor(true, -_vel, imp);
-            _enable();
-        }else{
-            ((btHingeConstraint *)_joint)->enableAngularMotor(false, 0., 0.);
-        }
+    if (!_joint)
+        return;
+
+    //DBG(this << " " << _vel << " " << _fmax);
+    if (!isZero(_fmax) && !isZero(_vel)){
+        imp = _fmax * time;
+        //DBG(imp << " " << _fmax << " " << time);
+        ((btHingeConstraint *)_joint)->enableAngularMotor(true, -_vel, imp);
+        _motor_on = true;
+    }else{
+        ((btHingeConstraint *)_joint)->enableAngularMotor(false, 0., 0.);
+        _motor_on = false;
     }
+
+    _motor_dirty = false;
 }
 
 } /* namespace bullet */
@@ -107,7 +107,10 @@ class JointHinge : public Joint {
     Scalar _lim[2]; //!< Limit lo, hi
     Scalar _vel; //!< Target velocity of angular motor
     Scalar _fmax; //!< Max force on angular motor
-    Scalar _impulse_max;
+
+    int _motor_idx; //!< Position in world's array of motors or -1
+    bool _motor_dirty; //!< True if motor must be reconfigured
+    bool _motor_on; //!< True if motor is enabled on constraint
 
     friend class World;
 
@@ -129,7 +132,11 @@ class JointHinge : public Joint {
     double paramFMax() const { return _fmax; }
 
   protected:
-    void _applyVelFMax(const sim::Time &time);
+    /**
+     * Configures motor of constraint according to _vel and _fmax.
+     * Force is converted to impulse using given time step (in seconds).
+     */
+    void _applyVelFMax(Scalar time);
 };
 
 } /* namespace bullet */
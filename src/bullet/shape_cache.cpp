@@ -0,0 +1,197 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <BulletCollision/CollisionShapes/btBoxShape.h>
+#include <BulletCollision/CollisionShapes/btSphereShape.h>
+#include <BulletCollision/CollisionShapes/btCylinderShape.h>
+#include <BulletCollision/CollisionShapes/btBvhTriangleMeshShape.h>
+
+#include "sim/bullet/shape_cache.hpp"
+#include "sim/bullet/math.hpp"
+#include "sim/common.hpp"
+
+namespace sim {
+
+namespace bullet {
+
+ShapeCache::ShapeCache()
+{
+}
+
+ShapeCache::~ShapeCache()
+{
+    mesh_t *m;
+
+    for_each(_prims_it_t, _prims){
+        delete it->second;
+    }
+    _prims.clear();
+
+    for_each(_meshes_it_t, _meshes){
+        m = it->second;
+        delete m->shape;
+        delete m->arr;
+        delete [] m->verts;
+        delete [] m->ids;
+        delete m;
+    }
+    _meshes.clear();
+}
+
+btCollisionShape *ShapeCache::box(const Vec3 &dim)
+{
+    return _prim(prim_key_t(BOX, dim.x(), dim.y(), dim.z()));
+}
+
+btCollisionShape *ShapeCache::sphere(Scalar radius)
+{
+    return _prim(prim_key_t(SPHERE, radius));
+}
+
+btCollisionShape *ShapeCache::cylinderZ(Scalar radius, Scalar height)
+{
+    return _prim(prim_key_t(CYLINDER, radius, height));
+}
+
+btCollisionShape *ShapeCache::triMesh(const Vec3 *coords, size_t coords_len,
+                                      const unsigned int *ids, size_t ids_len)
+{
+    unsigned long hash;
+    std::pair<_meshes_it_t, _meshes_it_t> range;
+    mesh_t *m;
+    btIndexedMesh part;
+    Vec3 v;
+
+    hash = _meshHash(coords, coords_len, ids, ids_len);
+    range = _meshes.equal_range(hash);
+    for (_meshes_it_t it = range.first; it != range.second; ++it){
+        if (_meshEq(it->second, coords, coords_len, ids, ids_len))
+            return it->second->shape;
+    }
+
+    m = new mesh_t;
+    m->verts_len = coords_len;
+    m->verts = new btScalar[3 * coords_len];
+    for (size_t i = 0; i < coords_len; i++){
+        m->verts[3 * i]     = coords[i].x();
+        m->verts[3 * i + 1] = coords[i].z();
+        m->verts[3 * i + 2] = coords[i].y();
+    }
+
+    m->ids_len = ids_len;
+    m->ids = new int[ids_len];
+    for (size_t i = 0; i < ids_len; i++){
+        m->ids[i] = ids[i];
+    }
+
+    part.m_numTriangles = ids_len / 3;
+    part.m_triangleIndexBase = (const unsigned char *)m->ids;
+    part.m_triangleIndexStride = 3 * sizeof(int);
+    part.m_numVertices = coords_len;
+    part.m_vertexBase = (const unsigned char *)m->verts;
+    part.m_vertexStride = 3 * sizeof(btScalar);
+    part.m_indexType = PHY_INTEGER;
+#ifdef BT_USE_DOUBLE_PRECISION
+    part.m_vertexType = PHY_DOUBLE;
+#else
+    part.m_vertexType = PHY_FLOAT;
+#endif
+
+    m->arr = new btTriangleIndexVertexArray();
+    m->arr->addIndexedMesh(part, PHY_INTEGER);
+    m->shape = new btBvhTriangleMeshShape(m->arr, true);
+
+    _meshes.insert(_meshes_t::value_type(hash, m));
+
+    return m->shape;
+}
+
+btCollisionShape *ShapeCache::_prim(const prim_key_t &key)
+{
+    btCollisionShape *shape;
+    _prims_it_t it;
+
+    it = _prims.find(key);
+    if (it != _prims.end())
+        return it->second;
+
+    shape = _createPrim(key);
+    _prims.insert(_prims_t::value_type(key, shape));
+    return shape;
+}
+
+btCollisionShape *ShapeCache::_createPrim(const prim_key_t &key)
+{
+    if (key.type == BOX){
+        return new btBoxShape(vToBt(Vec3(key.a, key.b, key.c) / 2.));
+    }else if (key.type == SPHERE){
+        return new btSphereShape(key.a);
+    }else{ // CYLINDER
+        return new btCylinderShape(vToBt(key.a, key.a, key.b / 2.));
+    }
+}
+
+unsigned long ShapeCache::_meshHash(const Vec3 *coords, size_t coords_len,
+                                    const unsigned int *ids, size_t ids_len)
+{
+    const unsigned char *d;
+    unsigned long hash = 2166136261UL; // FNV-1a
+    size_t i, len;
+
+    d = (const unsigned char *)coords;
+    len = coords_len * sizeof(Vec3);
+    for (i = 0; i < len; i++){
+        hash = (hash ^ d[i]) * 16777619UL;
+    }
+
+    d = (const unsigned char *)ids;
+    len = ids_len * sizeof(unsigned int);
+    for (i = 0; i < len; i++){
+        hash = (hash ^ d[i]) * 16777619UL;
+    }
+
+    return hash;
+}
+
+bool ShapeCache::_meshEq(const mesh_t *m, const Vec3 *coords, size_t coords_len,
+                         const unsigned int *ids, size_t ids_len)
+{
+    if (m->verts_len != coords_len || m->ids_len != ids_len)
+        return false;
+
+    for (size_t i = 0; i < ids_len; i++){
+        if (m->ids[i] != (int)ids[i])
+            return false;
+    }
+
+    for (size_t i = 0; i < coords_len; i++){
+        if (m->verts[3 * i] != (btScalar)coords[i].x()
+                || m->verts[3 * i + 1] != (btScalar)coords[i].z()
+                || m->verts[3 * i + 2] != (btScalar)coords[i].y())
+            return false;
+    }
+
+    return true;
+}
+
+} /* namespace bullet */
+
+} /* namespace sim */
@@ -0,0 +1,123 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_BULLET_SHAPE_CACHE_HPP_
+#define _SIM_BULLET_SHAPE_CACHE_HPP_
+
+#include <map>
+#include <BulletCollision/CollisionShapes/btCollisionShape.h>
+#include <BulletCollision/CollisionShapes/btTriangleIndexVertexArray.h>
+
+#include "sim/math.hpp"
+
+namespace sim {
+
+namespace bullet {
+
+/**
+ * Cache of collision shapes shared among bodies.
+ *
+ * Primitives are keyed by their type and dimensions, triangular meshes by
+ * their content. Bodies built from the same primitives (e.g. hundreds of
+ * identical robots) thus share one btCollisionShape instead of allocating
+ * their own. All shapes are owned by cache and are deleted with it, i.e.
+ * bodies must never delete shapes obtained from cache.
+ */
+class ShapeCache {
+  protected:
+    enum {
+        BOX = 1,
+        SPHERE,
+        CYLINDER
+    };
+
+    struct prim_key_t {
+        int type;
+        Scalar a, b, c;
+
+        prim_key_t(int t, Scalar _a, Scalar _b = 0., Scalar _c = 0.)
+            : type(t), a(_a), b(_b), c(_c) {}
+
+        bool operator<(const prim_key_t &k) const
+        {
+            if (type != k.type)
+                return type < k.type;
+            if (a != k.a)
+                return a < k.a;
+            if (b != k.b)
+                return b < k.b;
+            return c < k.c;
+        }
+    };
+    typedef std::map<prim_key_t, btCollisionShape *> _prims_t;
+    typedef _prims_t::iterator _prims_it_t;
+
+    /**
+     * Triangular mesh converted to Bullet's coordinates.
+     * Vertices are stored only once and are indexed by triangles, Bullet
+     * works directly on these arrays.
+     */
+    struct mesh_t {
+        btScalar *verts;
+        size_t verts_len;
+        int *ids;
+        size_t ids_len;
+        btTriangleIndexVertexArray *arr;
+        btCollisionShape *shape;
+    };
+    typedef std::multimap<unsigned long, mesh_t *> _meshes_t;
+    typedef _meshes_t::iterator _meshes_it_t;
+
+    _prims_t _prims;
+    _meshes_t _meshes;
+
+  public:
+    ShapeCache();
+    ~ShapeCache();
+
+    /* \{ */
+    btCollisionShape *box(const Vec3 &dim);
+    btCollisionShape *sphere(Scalar radius);
+    btCollisionShape *cylinderZ(Scalar radius, Scalar height);
+    btCollisionShape *triMesh(const Vec3 *coords, size_t coords_len,
+                              const unsigned int *indices, size_t indices_len);
+    /* \} */
+
+    /**
+     * Number of distinct shapes held in cache.
+     */
+    size_t size() const { return _prims.size() + _meshes.size(); }
+
+  protected:
+    btCollisionShape *_prim(const prim_key_t &key);
+    btCollisionShape *_createPrim(const prim_key_t &key);
+
+    static unsigned long _meshHash(const Vec3 *coords, size_t coords_len,
+                                   const unsigned int *ids, size_t ids_len);
+    static bool _meshEq(const mesh_t *m, const Vec3 *coords, size_t coords_len,
+                        const unsigned int *ids, size_t ids_len);
+};
+
+} /* namespace bullet */
+
+} /* namespace sim */
+
+#endif /* _SIM_BULLET_SHAPE_CACHE_HPP_ */
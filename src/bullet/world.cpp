@@ -35,19 +35,46 @@ namespace sim {
 
 namespace bullet {
 
+/**
+ * Passes bodies found by broadphase to spatial query callback.
+ */
+class QueryAABBCallback : public btBroadphaseAabbCallback {
+    World::_query_cb_t _cb;
+    void *_data;
+
+  public:
+    QueryAABBCallback(World::_query_cb_t cb, void *data)
+        : _cb(cb), _data(data) {}
+
+    bool process(const btBroadphaseProxy *proxy)
+    {
+        btCollisionObject *o = (btCollisionObject *)proxy->m_clientObject;
+        Body *b = (Body *)o->getUserPointer();
+
+        _cb(b, vFromBt(proxy->m_aabbMin), vFromBt(proxy->m_aabbMax), _data);
+        return true;
+    }
+};
+
+
 World::World()
     : sim::WorldBullet(),
       _coll_conf(0),
       _dispatch(0),
       _broadphase(0),
       _solver(0),
-      _world(0)
+      _world(0),
+      _shapes(0),
+      _ad_enabled(true), _ad_lin(0.8), _ad_ang(1.), _ad_time(2.),
+      _active_bodies(0),
+      _motors_time(0.)
 {
     _coll_conf = new btDefaultCollisionConfiguration();
     _dispatch = new CollisionDispatcher(_coll_conf);
     _broadphase = new btDbvtBroadphase();
     _solver = new btSequentialImpulseConstraintSolver();
     _world = new btDiscreteDynamicsWorld(_dispatch, _broadphase, _solver, _coll_conf);
+    _shapes = new ShapeCache();
 }
 
 World::~World()
@@ -65,6 +92,7 @@ World::~World()
     _joints.clear();
 
     delete _world;
+    delete _shapes;
     delete _solver;
     delete _broadphase;
     delete _dispatch;
@@ -79,6 +107,7 @@ World::~World()
 void World::init()
 {
     _world->setGravity(vToBt(_gravity));
+    gDeactivationTime = _ad_time;
 }
 
 void World::finish()
@@ -91,6 +120,8 @@ void World::step(const sim::Time &time, unsigned int substeps)
 
     btScalar fixed = time.inSF() / (double)substeps;
     _world->stepSimulation(time.inSF(), substeps, fixed);
+
+    _countActiveBodies();
 }
 
 
@@ -164,6 +195,74 @@ sim::Joint *World::createJointHinge2(sim::Body *oA, sim::Body *oB, const Vec3 &a
     return _createJoint(new JointHinge2(this, (Body *)oA, (Body *)oB, anchor, axis1, axis2));
 }
 
+size_t World::castRays(const Ray *rays, size_t n, RayHit *out)
+{
+    btVector3 from, to;
+    size_t hits = 0;
+
+    for (size_t i = 0; i < n; i++){
+        out[i] = RayHit();
+
+        from = vToBt(rays[i].from);
+        to = vToBt(rays[i].to);
+        btCollisionWorld::ClosestRayResultCallback cb(from, to);
+        _world->rayTest(from, to, cb);
+
+        if (cb.hasHit()){
+            out[i].hit = true;
+            out[i].point = vFromBt(cb.m_hitPointWorld);
+            out[i].normal = vFromBt(cb.m_hitNormalWorld);
+            out[i].dist = (out[i].point - rays[i].from).length();
+            out[i].body = (Body *)cb.m_collisionObject->getUserPointer();
+            ++hits;
+        }
+    }
+
+    return hits;
+}
+
+void World::_queryAABB(const Vec3 &min, const Vec3 &max, _query_cb_t cb, void *data)
+{
+    QueryAABBCallback qcb(cb, data);
+    _broadphase->aabbTest(vToBt(min), vToBt(max), qcb);
+}
+
+
+void World::setAutoDisable(Scalar linear_treshold, Scalar angular_treshold,
+                           Scalar time)
+{
+    _ad_enabled = true;
+    _ad_lin = linear_treshold;
+    _ad_ang = angular_treshold;
+    _ad_time = time;
+
+    // time-to-sleep is global in Bullet
+    gDeactivationTime = _ad_time;
+
+    _applyAutoDisable();
+}
+
+void World::resetAutoDisable()
+{
+    _ad_enabled = false;
+    _applyAutoDisable();
+}
+
+void World::setBodyForceAwake(sim::Body *b, bool yes)
+{
+    ((Body *)b)->setForceAwake(yes);
+}
+
+void World::setBodyAwake(sim::Body *b, bool awake)
+{
+    if (awake){
+        ((Body *)b)->wakeUp();
+    }else{
+        ((Body *)b)->sleep();
+    }
+}
+
+
 sim::Body *World::_createBody(sim::Body *b)
 {
     _bodies.push_back(b);
@@ -178,14 +277,64 @@ sim::Joint *World::_createJoint(sim::Joint *j)
 
 void World::_setJointsForceToImpulse(const sim::Time &time)
 {
-    Joint *j;
+    JointHinge *j;
+    Scalar t = time.inSF();
+    bool time_changed = (t != _motors_time);
+    size_t i = 0;
 
-    for_each(_joints_it_t, _joints){
-        j = (Joint *)*it;
+    _motors_time = t;
+
+    while (i < _motors.size()){
+        j = _motors[i];
+
+        if (j->_motor_dirty || time_changed){
+            j->_applyVelFMax(t);
+        }
 
-        if (j->isHinge()){
-            ((JointHinge *)j)->_applyVelFMax(time);
+        if (!j->_motor_dirty && !j->_motor_on){
+            // motor was switched off - remove joint from array
+            _motors[i] = _motors.back();
+            _motors[i]->_motor_idx = i;
+            _motors.pop_back();
+            j->_motor_idx = -1;
+            continue;
         }
+
+        // keep bodies driven by motor awake
+        if (j->_motor_on)
+            j->_enable();
+        ++i;
+    }
+}
+
+void World::_motorChanged(JointHinge *j)
+{
+    j->_motor_dirty = true;
+
+    if (j->_motor_idx < 0){
+        j->_motor_idx = _motors.size();
+        _motors.push_back(j);
+    }
+}
+
+void World::_applyAutoDisable()
+{
+    for_each(_bodies_it_t, _bodies){
+        ((Body *)*it)->_applyAutoDisable();
+    }
+}
+
+void World::_countActiveBodies()
+{
+    const btCollisionObjectArray &objs = _world->getCollisionObjectArray();
+    const btCollisionObject *o;
+    int i, len = objs.size();
+
+    _active_bodies = 0;
+    for (i = 0; i < len; i++){
+        o = objs[i];
+        if (!o->isStaticOrKinematicObject() && o->isActive())
+            ++_active_bodies;
     }
 }
 
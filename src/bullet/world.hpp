@@ -28,11 +28,14 @@
 #include <BulletDynamics/ConstraintSolver/btConstraintSolver.h>
 #include <BulletDynamics/Dynamics/btDynamicsWorld.h>
 
+#include <vector>
+
 #include "sim/visworld.hpp"
 #include "sim/world.hpp"
 #include "sim/bullet/body.hpp"
 #include "sim/bullet/joint.hpp"
 #include "sim/bullet/collision_detection.hpp"
+#include "sim/bullet/shape_cache.hpp"
 
 namespace sim {
 
@@ -43,6 +46,8 @@ namespace bullet {
  * Physical representation world.
  */
 class World : public sim::WorldBullet {
+    friend class JointHinge;
+
   protected:
     typedef std::list<sim::Body *> _bodies_t;
     typedef _bodies_t::iterator _bodies_it_t;
@@ -54,16 +59,29 @@ class World : public sim::WorldBullet {
     btBroadphaseInterface *_broadphase;
     btConstraintSolver *_solver;
     btDynamicsWorld *_world;
+    ShapeCache *_shapes; //!< Collision shapes shared among bodies
 
     _bodies_t _bodies;
     _joints_t _joints;
 
+    bool _ad_enabled; //!< True if auto disabling is enabled
+    Scalar _ad_lin, _ad_ang, _ad_time; //!< Auto disable thresholds
+    size_t _active_bodies; //!< Number of awake bodies in last step
+
+    /**
+     * Hinges with motor parameters set. Only these are visited in each
+     * step.
+     */
+    std::vector<JointHinge *> _motors;
+    Scalar _motors_time; //!< Time step motors' impulses were computed for
+
   public:
     World();
     virtual ~World();
 
     btDynamicsWorld *world() { return _world; }
     const btDynamicsWorld *world() const { return _world; }
+    ShapeCache *shapeCache() { return _shapes; }
 
     /**
      * Initializes world.
@@ -102,15 +120,57 @@ class World : public sim::WorldBullet {
     sim::Joint *createJointHinge2(sim::Body *A, sim::Body *oB, const Vec3 &anchor,
                                   const Vec3 &axis1, const Vec3 &axis2);
 
+    /* \{ */
+    void setAutoDisable(Scalar linear_treshold = 0.8, Scalar angular_treshold = 1.,
+                        Scalar time = 2.);
+    void resetAutoDisable();
+    bool autoDisable() const { return _ad_enabled; }
+    Scalar autoDisableLinear() const { return _ad_lin; }
+    Scalar autoDisableAngular() const { return _ad_ang; }
+    Scalar autoDisableTime() const { return _ad_time; }
+
+    void setBodyForceAwake(sim::Body *b, bool yes = true);
+    void setBodyAwake(sim::Body *b, bool awake = true);
+
+    size_t numActiveBodies() const { return _active_bodies; }
+    /* \} */
+
+    /**
+     * Rays are traced using btCollisionWorld::rayTest() which walks
+     * dynamic AABB tree of broadphase.
+     */
+    size_t castRays(const Ray *rays, size_t n, RayHit *out);
 
   protected:
+    /**
+     * Queries dynamic AABB tree of broadphase.
+     */
+    void _queryAABB(const Vec3 &min, const Vec3 &max, _query_cb_t cb, void *data);
+
     sim::Body *_createBody(sim::Body *);
     sim::Joint *_createJoint(sim::Joint *);
 
     /**
-     * Iterates over all joints and converts all forces to impulses.
+     * Iterates over motorized hinges and converts forces to impulses.
+     * Impulse is recomputed only if motor parameters or time step have
+     * changed since last step.
      */
     void _setJointsForceToImpulse(const sim::Time &time);
+
+    /**
+     * Called by hinge whenever motor parameters change.
+     */
+    void _motorChanged(JointHinge *j);
+
+    /**
+     * Applies auto disable settings on all bodies.
+     */
+    void _applyAutoDisable();
+
+    /**
+     * Counts dynamic bodies that are awake.
+     */
+    void _countActiveBodies();
 };
 
 } /* namespace bullet */
@@ -20,14 +20,28 @@
  */
 
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <algorithm>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define PACK_ROW4_SSSE3
+# include <tmmintrin.h>
+#endif
 #include "comp/rserver.hpp"
+#include "comp/rserver_shm.hpp"
 #include "msg.hpp"
 #include "sim.hpp"
-#include <osgDB/WriteFile>
+#include "sim/common.hpp"
 
 namespace sim {
 namespace comp {
@@ -46,118 +60,239 @@ RMessageOutRF::RMessageOutRF(uint16_t id, const sim::sensor::RangeFinder &rf)
 }
 
 RMessageOutImg::RMessageOutImg(uint16_t id, const sim::sensor::Camera &cam)
-    : RMessageOut(id, RMessage::MSG_IMG), _data(NULL)
+    : RMessageOut(id, RMessage::MSG_IMG), _width(0), _height(0),
+      _img(cam.image())
 {
-    const osg::Image *img;
-    osg::Vec4 rgb;
-    size_t i, j, k, w, h;
-
-    img = cam.image();
-
-    w = img->s();
-    h = img->t();
-
-    _width  = w;
-    _height = h;
-    _data   = new unsigned char[3 * w * h];
+    // no frame was rendered yet
+    if (!_img.valid() || !_img->data())
+        return;
 
-    k = 0;
-    for (j = 0; j < h; j++){
-        for (i = 0; i < w; i++){
-            rgb = img->getColor(i, j);
-            _data[k++] = (unsigned char)(rgb.b() * 255);
-            _data[k++] = (unsigned char)(rgb.g() * 255);
-            _data[k++] = (unsigned char)(rgb.r() * 255);
-        }
-    }
+    _width  = _img->s();
+    _height = _img->t();
 }
 
-RMessageOutImg::~RMessageOutImg()
+#ifdef PACK_ROW4_SSSE3
+/**
+ * SSSE3 part of packRow4(), converts 16 pixels at once.
+ * Returns number of converted pixels.
+ * Compiled for SSSE3 regardless of compiler flags, so it must be called
+ * only if CPU supports it.
+ */
+__attribute__((target("ssse3")))
+static size_t packRow4SSSE3(unsigned char *dst, const unsigned char *src,
+                            size_t w, int c0, int c1, int c2)
 {
-    if (_data)
-        delete [] _data;
-}
+    __m128i mask, a, b, c, d;
+    char m[16];
+    size_t i;
+    int k;
+
+    // shuffle 4 pixels into 12 low bytes, top 4 bytes are zeroed
+    for (k = 0; k < 4; k++){
+        m[3 * k + 0] = 4 * k + c0;
+        m[3 * k + 1] = 4 * k + c1;
+        m[3 * k + 2] = 4 * k + c2;
+    }
+    m[12] = m[13] = m[14] = m[15] = (char)0x80;
+    mask = _mm_loadu_si128((const __m128i *)m);
+
+    for (i = 0; i + 16 <= w; i += 16){
+        a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 0)), mask);
+        b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 16)), mask);
+        c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 32)), mask);
+        d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 48)), mask);
+
+        _mm_storeu_si128((__m128i *)(dst + 0),
+                         _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128((__m128i *)(dst + 16),
+                         _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128((__m128i *)(dst + 32),
+                         _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+
+        src += 64;
+        dst += 48;
+    }
 
+    return i;
+}
+#endif /* PACK_ROW4_SSSE3 */
 
-void *RServerSession::thread(void *_s)
+/**
+ * Converts row of 4-byte pixels to BGR, c0, c1, c2 are offsets of blue,
+ * green and red channel within pixel.
+ */
+static void packRow4(unsigned char *dst, const unsigned char *src, size_t w,
+                     int c0, int c1, int c2)
 {
-    RServerSession *s = (RServerSession *)_s;
-    uint16_t id;
-    char type;
-    float f;
+    size_t i = 0;
 
-    while (true){
-        // first read ID
-        if (s->_readID(&id) != 0)
-            break;
-
-        // then read type
-        if (s->_readType(&type) != 0)
-            break;
-
-        DBG("id: " << id << " type: " << (int)type);
-
-        if (type == RMessage::MSG_PING){
-            s->_server->__addMessage(new RMessageInPing(id));
-
-        }else if (type == RMessage::MSG_PONG){
-            s->_server->__addMessage(new RMessageInPong(id));
-
-        }else if (type == RMessage::MSG_GET_POS){
-            s->_server->__addMessage(new RMessageInGetPos(id));
+#ifdef PACK_ROW4_SSSE3
+    // SSSE3 isn't part of x86-64 baseline, so it's detected at runtime
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
 
-        }else if (type == RMessage::MSG_GET_ROT){
-            s->_server->__addMessage(new RMessageInGetRot(id));
+    if (ssse3){
+        i = packRow4SSSE3(dst, src, w, c0, c1, c2);
+        src += 4 * i;
+        dst += 3 * i;
+    }
+#endif /* PACK_ROW4_SSSE3 */
+
+    for (; i < w; i++){
+        dst[0] = src[c0];
+        dst[1] = src[c1];
+        dst[2] = src[c2];
+        src += 4;
+        dst += 3;
+    }
+}
 
-        }else if (type == RMessage::MSG_SET_VEL_LEFT){
-            if (s->_readFloat(&f) != 0)
-                break;
-            s->_server->__addMessage(new RMessageInSetVelLeft(id, f));
+void RMessageOutImg::pack(unsigned char *dst) const
+{
+    const unsigned char *src;
+    GLenum format;
+    osg::Vec4 rgb;
+    size_t i, j, w, h;
 
-        }else if (type == RMessage::MSG_SET_VEL_RIGHT){
-            if (s->_readFloat(&f) != 0)
-                break;
-            s->_server->__addMessage(new RMessageInSetVelRight(id, f));
+    w = _width;
+    h = _height;
+    if (w == 0 || h == 0)
+        return;
 
-        }else if (type == RMessage::MSG_GET_RF){
-            s->_server->__addMessage(new RMessageInGetRF(id));
+    format = _img->getPixelFormat();
+    if (_img->getDataType() != GL_UNSIGNED_BYTE)
+        format = 0;
 
-        }else if (type == RMessage::MSG_GET_IMG){
-            s->_server->__addMessage(new RMessageInGetImg(id));
+    // rows are addressed separately because image can have longer rows
+    // (see CameraAtlas)
+    for (j = 0; j < h; j++){
+        src = _img->data(0, j);
+
+        if (format == GL_BGR){
+            memcpy(dst, src, 3 * w);
+            dst += 3 * w;
+
+        }else if (format == GL_RGB){
+            for (i = 0; i < w; i++){
+                dst[0] = src[2];
+                dst[1] = src[1];
+                dst[2] = src[0];
+                src += 3;
+                dst += 3;
+            }
+
+        }else if (format == GL_RGBA){
+            packRow4(dst, src, w, 2, 1, 0);
+            dst += 3 * w;
+
+        }else if (format == GL_BGRA){
+            packRow4(dst, src, w, 0, 1, 2);
+            dst += 3 * w;
+
+        }else if (format == GL_LUMINANCE){
+            for (i = 0; i < w; i++){
+                dst[0] = dst[1] = dst[2] = src[i];
+                dst += 3;
+            }
 
         }else{
-            s->_server->__addMessage(new RMessageIn(id, type));
+            // generic but slow path
+            for (i = 0; i < w; i++){
+                rgb = _img->getColor(i, j);
+                *dst++ = (unsigned char)(rgb.b() * 255);
+                *dst++ = (unsigned char)(rgb.g() * 255);
+                *dst++ = (unsigned char)(rgb.r() * 255);
+            }
         }
     }
+}
 
 
-    s->_server->__addSessionToJoin(s);
-    return NULL;
+/**
+ * Creates request without payload of given type.
+ */
+static RMessageIn *newRequest(uint16_t id, char type)
+{
+    if (type == RMessage::MSG_PING){
+        return new RMessageInPing(id);
+    }else if (type == RMessage::MSG_PONG){
+        return new RMessageInPong(id);
+    }else if (type == RMessage::MSG_GET_POS){
+        return new RMessageInGetPos(id);
+    }else if (type == RMessage::MSG_GET_ROT){
+        return new RMessageInGetRot(id);
+    }else if (type == RMessage::MSG_GET_RF){
+        return new RMessageInGetRF(id);
+    }else if (type == RMessage::MSG_GET_IMG){
+        return new RMessageInGetImg(id);
+    }
+    return new RMessageIn(id, type);
 }
 
+/**
+ * Returns type of reply to request of given type or 0 if request has no
+ * reply.
+ */
+static char replyType(char type)
+{
+    if (type == RMessage::MSG_PING){
+        return RMessage::MSG_PONG;
+    }else if (type == RMessage::MSG_GET_POS){
+        return RMessage::MSG_POS;
+    }else if (type == RMessage::MSG_GET_ROT){
+        return RMessage::MSG_ROT;
+    }else if (type == RMessage::MSG_GET_RF){
+        return RMessage::MSG_RF;
+    }else if (type == RMessage::MSG_GET_IMG){
+        return RMessage::MSG_IMG;
+    }
+    return 0;
+}
 
-RServerSession::RServerSession(RServer *s, int sock)
-    : _server(s), _sock(sock), _bufstart(0), _bufend(0)
+/**
+ * Returns true if serialized message is control frame (end of step or
+ * reply to batch) that must not be dropped.
+ */
+static bool isControl(const std::vector<char> &msg)
 {
+    return msg[2] == RMessage::MSG_STEP || msg[2] == RMessage::MSG_BATCH;
 }
 
-RServerSession::~RServerSession()
+static int setNonBlocking(int fd)
 {
-    DBG(this);
-    pthread_join(_th, NULL);
-    shutdown(_sock, SHUT_RDWR);
-    close(_sock);
+    int flags;
+
+    flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-void RServerSession::run()
+
+RServerSession::RServerSession(RServer *s, int sock)
+    : _server(s), _sock(sock), _closed(false), _want_out(false),
+      _queue_off(0), _queue_max(SIM_RSERVER_QUEUE_LEN),
+      _overflow(OVERFLOW_DROP_OLDEST), _overflowed(false),
+      _dropped(0), _queue_peak(0),
+      _lockstep(false), _lockstep_join(false), _step_done(0), _kicked(false)
 {
-    pthread_create(&_th, NULL, thread, (void *)this);
+    pthread_mutex_init(&_lock, NULL);
 }
 
-void RServerSession::cancel()
+RServerSession::~RServerSession()
 {
     DBG(this);
-    pthread_cancel(_th);
+
+    for_each(std::list<std::vector<char> *>::iterator, _pending){
+        delete *it;
+    }
+    _dropQueue();
+
+    if (_sock >= 0){
+        shutdown(_sock, SHUT_RDWR);
+        close(_sock);
+    }
+
+    pthread_mutex_destroy(&_lock);
 }
 
 void RServerSession::sendMessage(const RMessageOut &msg)
@@ -191,85 +326,583 @@ void RServerSession::sendMessage(const RMessageOut &msg)
         }
 
     }else if (msg.msgType() == RMessage::MSG_IMG){
-        size_t i, len;
-        size_t width = ((const RMessageOutImg *)&msg)->width();
-        size_t height = ((const RMessageOutImg *)&msg)->height();
-        const unsigned char *data = ((const RMessageOutImg *)&msg)->data();
+        const RMessageOutImg *img = (const RMessageOutImg *)&msg;
+        size_t width = img->width();
+        size_t height = img->height();
+        size_t off;
 
         DBG("Sending MSG_IMG " << width << "x" << height);
 
         _writeUInt16(width);
         _writeUInt16(height);
 
-        len = width * height * 3;
-        for (i = 0; i < len; i++){
-            _writeByte(data[i]);
-        }
+        // image is converted right into the output buffer
+        off = _out.size();
+        _out.resize(off + width * height * 3);
+        img->pack((unsigned char *)&_out[0] + off);
     }
+
+    _pending.push_back(new std::vector<char>());
+    _pending.back()->swap(_out);
 }
 
-int RServerSession::_readByte(char *b)
+void RServerSession::setQueueLimit(size_t max, Overflow policy)
 {
-    ssize_t readsize;
+    pthread_mutex_lock(&_lock);
+    _queue_max = (max > 0 ? max : 1);
+    _overflow  = policy;
+    pthread_mutex_unlock(&_lock);
+}
 
-    //DBG("%d %d", (int)r->bufstart, (int)r->bufend);
+bool RServerSession::overflowed()
+{
+    bool ret;
+    pthread_mutex_lock(&_lock);
+    ret = _overflowed;
+    pthread_mutex_unlock(&_lock);
+    return ret;
+}
 
-    if (_bufstart == _bufend){
-        readsize = read(_sock, _buf, SIM_RSERVER_BUFSIZE);
-        if (readsize <= 0)
-            return -1;
+size_t RServerSession::queueDepth()
+{
+    size_t ret;
+    pthread_mutex_lock(&_lock);
+    ret = _queue.size();
+    pthread_mutex_unlock(&_lock);
+    return ret;
+}
+
+size_t RServerSession::queuePeak()
+{
+    size_t ret;
+    pthread_mutex_lock(&_lock);
+    ret = _queue_peak;
+    pthread_mutex_unlock(&_lock);
+    return ret;
+}
+
+unsigned long RServerSession::dropped()
+{
+    unsigned long ret;
+    pthread_mutex_lock(&_lock);
+    ret = _dropped;
+    pthread_mutex_unlock(&_lock);
+    return ret;
+}
+
+bool RServerSession::commit(unsigned long delivered, unsigned long step)
+{
+    std::deque<std::vector<char> *>::iterator victim;
+    std::list<std::vector<char> *> out, rest;
+    std::list<batch_t>::iterator b;
+    std::list<uint32_t>::iterator r;
+    std::vector<char> *msg;
+    uint32_t key;
+    uint16_t v;
+    bool ret;
+
+    pthread_mutex_lock(&_lock);
+
+    // batch waits for replies at most SIM_RSERVER_BATCH_WAIT steps since
+    // it was delivered
+    for (b = _batches.begin(); b != _batches.end() && b->gen < delivered; ++b){
+        if (!b->delivered){
+            b->delivered = true;
+            b->due = step + SIM_RSERVER_BATCH_WAIT - 1;
+        }
+    }
+
+    // reply goes to the oldest delivered batch expecting it, everything
+    // else (replies to requests outside batch, broadcasts, MSG_STEP...)
+    // is sent on its own
+    for_each(std::list<std::vector<char> *>::iterator, _pending){
+        memcpy(&v, &(**it)[0], 2);
+        key = ((uint32_t)ntohs(v) << 8) | (unsigned char)(**it)[2];
+
+        for (b = _batches.begin(); b != _batches.end() && b->delivered; ++b){
+            r = std::find(b->replies.begin(), b->replies.end(), key);
+            if (r != b->replies.end())
+                break;
+        }
+
+        if (b != _batches.end() && b->delivered){
+            b->replies.erase(r);
+            b->msg.insert(b->msg.end(), (*it)->begin(), (*it)->end());
+            ++b->count;
+            delete *it;
+        }else{
+            rest.push_back(*it);
+        }
+    }
+    _pending.clear();
+
+    // batches are answered in order, each as soon as all its replies
+    // arrived (or it waited long enough, reply may never come)
+    while (!_batches.empty() && _batches.front().delivered){
+        b = _batches.begin();
+        if (!b->replies.empty() && step < b->due)
+            break;
+
+        msg = new std::vector<char>(5);
+        v = htons(b->id);
+        memcpy(&(*msg)[0], &v, 2);
+        (*msg)[2] = RMessage::MSG_BATCH;
+        v = htons(b->count);
+        memcpy(&(*msg)[3], &v, 2);
+        msg->insert(msg->end(), b->msg.begin(), b->msg.end());
+        out.push_back(msg);
 
-        _bufstart = _buf;
-        _bufend = _buf + readsize;
+        _batches.pop_front();
     }
+    out.splice(out.end(), rest);
 
-    *b = *_bufstart;
-    ++_bufstart;
+    for_each(std::list<std::vector<char> *>::iterator, out){
+        if (_overflowed){
+            // session is going to be disconnected anyway
+            delete *it;
+            continue;
+        }
+
+        // control frames are never dropped, client would wait for them
+        // forever, so they can exceed the limit
+        if (_queue.size() < _queue_max || isControl(**it)){
+            _queue.push_back(*it);
+            continue;
+        }
+
+        // queue is full
+        ++_dropped;
+        if (_overflow == OVERFLOW_DROP_NEW){
+            delete *it;
+
+        }else if (_overflow == OVERFLOW_DROP_OLDEST){
+            // partially sent message can't be dropped without breaking
+            // the stream
+            victim = _queue.begin();
+            if (_queue_off > 0)
+                ++victim;
+            while (victim != _queue.end() && isControl(**victim))
+                ++victim;
+
+            if (victim != _queue.end()){
+                delete *victim;
+                _queue.erase(victim);
+                _queue.push_back(*it);
+            }else{
+                delete *it;
+            }
+
+        }else{ // OVERFLOW_DISCONNECT
+            _overflowed = true;
+            delete *it;
+        }
+    }
+
+    if (_queue.size() > _queue_peak)
+        _queue_peak = _queue.size();
+    ret = !_queue.empty() || _overflowed;
+
+    pthread_mutex_unlock(&_lock);
+
+    return ret;
+}
+
+int RServerSession::readInput()
+{
+    ssize_t size;
+
+    while (true){
+        size = recv(_sock, _buf, SIM_RSERVER_BUFSIZE, 0);
+        if (size > 0){
+            _in.insert(_in.end(), _buf, _buf + size);
+        }else if (size == 0){
+            // connection closed by peer
+            return -1;
+        }else if (errno == EINTR){
+            continue;
+        }else if (errno == EAGAIN || errno == EWOULDBLOCK){
+            break;
+        }else{
+            return -1;
+        }
+    }
 
+    _parseInput();
     return 0;
 }
 
-int RServerSession::_readID(uint16_t *id)
+int RServerSession::writeOutput()
 {
-    char *cid = (char *)id;
+    struct iovec iov[SIM_RSERVER_MAX_IOV];
+    struct msghdr msg;
+    std::deque<std::vector<char> *>::iterator it, it_end;
+    std::vector<char> *buf;
+    size_t n, len;
+    ssize_t size;
+    int ret = 0;
+
+    pthread_mutex_lock(&_lock);
+
+    while (!_queue.empty()){
+        // gather as many queued messages as possible into one syscall
+        n = 0;
+        it = _queue.begin();
+        it_end = _queue.end();
+        for (; it != it_end && n < SIM_RSERVER_MAX_IOV; ++it, ++n){
+            iov[n].iov_base = &(**it)[0];
+            iov[n].iov_len  = (*it)->size();
+        }
+        iov[0].iov_base = (char *)iov[0].iov_base + _queue_off;
+        iov[0].iov_len -= _queue_off;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+
+        size = sendmsg(_sock, &msg, MSG_NOSIGNAL);
+        if (size < 0){
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                ret = 1;
+            }else{
+                DBG("sendmsg() failed: " << strerror(errno));
+                ret = -1;
+            }
+            break;
+        }
 
-    if (_readByte(cid + 0) != 0)
-        return -1;
-    if (_readByte(cid + 1) != 0)
-        return -1;
+        // remove all messages that were sent completely
+        len = size;
+        while (len > 0){
+            buf = _queue.front();
+            if (len < buf->size() - _queue_off){
+                _queue_off += len;
+                break;
+            }
+
+            len -= buf->size() - _queue_off;
+            _queue_off = 0;
+            _queue.pop_front();
+            delete buf;
+        }
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    return ret;
+}
+
+void RServerSession::_address(uint16_t id)
+{
+    pthread_mutex_lock(&_lock);
+    _ids.insert(id);
+    pthread_mutex_unlock(&_lock);
+}
+
+bool RServerSession::addressed(uint16_t id)
+{
+    bool ret;
+    pthread_mutex_lock(&_lock);
+    ret = (_ids.find(id) != _ids.end());
+    pthread_mutex_unlock(&_lock);
+    return ret;
+}
+
+bool RServerSession::lockstepReady(unsigned long step)
+{
+    bool ret = true;
+
+    pthread_mutex_lock(&_lock);
+    if (_lockstep){
+        // client that has just joined doesn't know number of the step
+        // yet, it will be told by the following MSG_STEP
+        if (_lockstep_join){
+            _step_done = step;
+            _lockstep_join = false;
+        }
+        ret = (_step_done >= step);
+    }
+    pthread_mutex_unlock(&_lock);
+
+    return ret;
+}
 
-    *id = ntohs(*id);
+void RServerSession::lockstepRelease()
+{
+    pthread_mutex_lock(&_lock);
+    _lockstep = false;
+    pthread_mutex_unlock(&_lock);
+}
+
+void RServerSession::sendStep(unsigned long step)
+{
+    bool send;
+
+    pthread_mutex_lock(&_lock);
+    send = _lockstep && !_lockstep_join;
+    pthread_mutex_unlock(&_lock);
+
+    if (!send)
+        return;
+
+    _writeID(0);
+    _writeType(RMessage::MSG_STEP);
+    _writeUInt32(step);
+
+    _pending.push_back(new std::vector<char>());
+    _pending.back()->swap(_out);
+}
+
+void RServerSession::kick()
+{
+    pthread_mutex_lock(&_lock);
+    _kicked = true;
+    pthread_mutex_unlock(&_lock);
+}
+
+bool RServerSession::kicked()
+{
+    bool ret;
+    pthread_mutex_lock(&_lock);
+    ret = _kicked;
+    pthread_mutex_unlock(&_lock);
+    return ret;
+}
+
+void RServerSession::_stepDone(unsigned long step)
+{
+    DBG("step: " << step);
+
+    pthread_mutex_lock(&_lock);
+    if (!_lockstep){
+        _lockstep = true;
+        _lockstep_join = true;
+    }else if (step > _step_done){
+        _step_done = step;
+    }
+    pthread_mutex_unlock(&_lock);
+
+    _server->__stepDone();
+}
+
+void RServerSession::_dropQueue()
+{
+    for_each(std::deque<std::vector<char> *>::iterator, _queue){
+        delete *it;
+    }
+    _queue.clear();
+    _queue_off = 0;
+}
+
+size_t RServerSession::_payloadSize(char type) const
+{
+    if (type == RMessage::MSG_SET_VEL_LEFT
+            || type == RMessage::MSG_SET_VEL_RIGHT)
+        return 4;
+    if (type == RMessage::MSG_SUBSCRIBE)
+        return 3;
+    if (type == RMessage::MSG_STEP_DONE)
+        return 4;
     return 0;
 }
 
-int RServerSession::_readType(char *type)
+void RServerSession::_subscribe(uint16_t id, char type, uint16_t period)
 {
-    return _readByte(type);
+    std::list<sub_t>::iterator it, it_end;
+    sub_t sub;
+
+    if (type != RMessage::MSG_GET_POS && type != RMessage::MSG_GET_ROT
+            && type != RMessage::MSG_GET_RF && type != RMessage::MSG_GET_IMG){
+        DBG("Can't subscribe to " << (int)type);
+        return;
+    }
+
+    DBG("id: " << id << " type: " << (int)type << " period: " << period);
+
+    pthread_mutex_lock(&_lock);
+
+    _ids.insert(id);
+
+    // replace (or remove if period is zero) already existing subscription
+    it = _subs.begin();
+    it_end = _subs.end();
+    for (; it != it_end; ++it){
+        if (it->id == id && it->type == type){
+            _subs.erase(it);
+            break;
+        }
+    }
+
+    if (period > 0){
+        sub.id = id;
+        sub.type = type;
+        sub.period = period;
+        _subs.push_back(sub);
+    }
+
+    pthread_mutex_unlock(&_lock);
 }
 
-int RServerSession::_readFloat(float *f)
+void RServerSession::dueSubscriptions(unsigned long step,
+                                      std::vector<uint32_t> &reqs)
 {
-    uint32_t i;
-    char *c, *cf;
+    pthread_mutex_lock(&_lock);
+    for_each(std::list<sub_t>::iterator, _subs){
+        if (step % it->period == 0)
+            reqs.push_back(((uint32_t)it->id << 8) | (unsigned char)it->type);
+    }
+    pthread_mutex_unlock(&_lock);
+}
 
-    c = (char *)&i;
-    if (_readByte(c + 0) != 0)
-        return -1;
-    if (_readByte(c + 1) != 0)
-        return -1;
-    if (_readByte(c + 2) != 0)
-        return -1;
-    if (_readByte(c + 3) != 0)
-        return -1;
+void RServerSession::_parseInput()
+{
+    std::list<RMessage *> msgs;
+    batch_t batch;
+    const char *data;
+    size_t pos, len, size, bpos;
+    uint16_t id, count, i;
+    char type;
+
+    data = _in.empty() ? NULL : &_in[0];
+    len  = _in.size();
+    pos  = 0;
+
+    while ((size = _messageSize(data + pos, len - pos)) > 0){
+        if (data[pos + 2] != RMessage::MSG_BATCH){
+            _parseMessage(data + pos, msgs);
+            pos += size;
+            continue;
+        }
+
+        // all messages of batch must be delivered in the same step, so
+        // preceding messages are passed first and then the batch at once
+        _server->__addMessages(msgs);
+
+        memcpy(&id, data + pos, 2);
+        memcpy(&count, data + pos + 3, 2);
+        id = ntohs(id);
+        count = ntohs(count);
+        DBG("batch id: " << id << " count: " << count);
+
+        batch.id = id;
+        batch.delivered = false;
+        batch.due = 0;
+        batch.count = 0;
+        batch.replies.clear();
+        batch.msg.clear();
+
+        bpos = pos + 5;
+        for (i = 0; i < count; i++){
+            if (data[bpos + 2] != RMessage::MSG_BATCH)
+                _parseMessage(data + bpos, msgs);
+
+            // remember which replies belong to the batch
+            if ((type = replyType(data[bpos + 2])) != 0){
+                memcpy(&id, data + bpos, 2);
+                batch.replies.push_back(((uint32_t)ntohs(id) << 8)
+                                            | (unsigned char)type);
+            }
+            bpos += 3 + _payloadSize(data[bpos + 2]);
+        }
+
+        // session lock is held so that commit() can't see the messages
+        // delivered without knowing about the batch
+        pthread_mutex_lock(&_lock);
+        batch.gen = _server->__addBatch(msgs);
+        _batches.push_back(batch);
+        pthread_mutex_unlock(&_lock);
+
+        pos += size;
+    }
+
+    _server->__addMessages(msgs);
+
+    _in.erase(_in.begin(), _in.begin() + pos);
+}
+
+size_t RServerSession::_messageSize(const char *data, size_t len) const
+{
+    size_t size;
+    uint16_t count, i;
+
+    // header of each message is 2B id and 1B type
+    if (len < 3)
+        return 0;
+
+    if (data[2] != RMessage::MSG_BATCH){
+        size = 3 + _payloadSize(data[2]);
+        return (len >= size ? size : 0);
+    }
+
+    if (len < 5)
+        return 0;
+    memcpy(&count, data + 3, 2);
+    count = ntohs(count);
+
+    // batch can't be nested, nested MSG_BATCH is taken as message without
+    // payload
+    size = 5;
+    for (i = 0; i < count; i++){
+        if (len < size + 3)
+            return 0;
+        size += 3 + _payloadSize(data[size + 2]);
+    }
+
+    return (len >= size ? size : 0);
+}
+
+void RServerSession::_parseMessage(const char *data,
+                                   std::list<RMessage *> &msgs)
+{
+    uint16_t id, period;
+    uint32_t step;
+    char type;
 
+    memcpy(&id, data, 2);
+    id = ntohs(id);
+    type = data[2];
+    data += 3;
+
+    DBG("id: " << id << " type: " << (int)type);
+
+    if (type == RMessage::MSG_STEP_DONE){
+        // requests sent before belong to the finished step, so they must
+        // be passed to server before it is allowed to continue
+        _server->__addMessages(msgs);
+
+        memcpy(&step, data, 4);
+        _stepDone(ntohl(step));
+        return;
+    }
+
+    _address(id);
+
+    if (type == RMessage::MSG_SET_VEL_LEFT){
+        msgs.push_back(new RMessageInSetVelLeft(id, _parseFloat(data)));
+
+    }else if (type == RMessage::MSG_SET_VEL_RIGHT){
+        msgs.push_back(new RMessageInSetVelRight(id, _parseFloat(data)));
+
+    }else if (type == RMessage::MSG_SUBSCRIBE){
+        memcpy(&period, data + 1, 2);
+        _subscribe(id, data[0], ntohs(period));
+
+    }else{
+        msgs.push_back(newRequest(id, type));
+    }
+}
+
+float RServerSession::_parseFloat(const char *c) const
+{
+    uint32_t i;
+    float f;
+
+    memcpy(&i, c, 4);
     i = ntohl(i);
-    cf = (char *)f;
-    cf[0] = c[0];
-    cf[1] = c[1];
-    cf[2] = c[2];
-    cf[3] = c[3];
+    memcpy(&f, &i, 4);
 
-    return 0;
+    return f;
 }
 
 
@@ -280,15 +913,16 @@ int RServerSession::_writeID(uint16_t _id)
 
 int RServerSession::_writeUInt16(uint16_t _i)
 {
-    ssize_t size;
     uint16_t i;
 
     i = htons(_i);
+    return _writeData(&i, sizeof(uint16_t));
+}
 
-    size = write(_sock, (void *)&i, sizeof(uint16_t));
-    if (size != sizeof(uint16_t))
-        return -1;
-    return 0;
+int RServerSession::_writeUInt32(uint32_t _i)
+{
+    uint32_t i = htonl(_i);
+    return _writeData(&i, 4);
 }
 
 int RServerSession::_writeType(char type)
@@ -296,19 +930,14 @@ int RServerSession::_writeType(char type)
     return _writeByte(type);
 }
 
-int RServerSession::_writeByte(char type)
+int RServerSession::_writeByte(char b)
 {
-    ssize_t size;
-
-    size = write(_sock, &type, sizeof(char));
-    if (size != 1)
-        return -1;
+    _out.push_back(b);
     return 0;
 }
 
 int RServerSession::_writeFloat(float f)
 {
-    ssize_t size;
     uint32_t i;
     char *c, *cf;
 
@@ -320,31 +949,56 @@ int RServerSession::_writeFloat(float f)
     c[3] = cf[3];
     i = htonl(i);
 
-    size = write(_sock, (void *)&i, 4);
-    if (size != 4)
-        return -1;
-    return 0;
+    return _writeData(&i, 4);
 }
 
+int RServerSession::_writeData(const void *data, size_t len)
+{
+    const char *d = (const char *)data;
+    _out.insert(_out.end(), d, d + len);
+    return 0;
+}
 
 
 RServer::RServer(const char *addr, uint16_t port)
     : sim::Component(Component::PRIO_HIGHEST),
-      _sim(0), _addr(addr), _port(port), _sock(-1)
+      _sim(0), _addr(addr), _port(port), _sock(-1), _unix_sock(-1),
+      _epfd(-1), _wakefd(-1),
+      _th_running(false), _quit(false),
+      _queue_max(SIM_RSERVER_QUEUE_LEN),
+      _overflow(RServerSession::OVERFLOW_DROP_OLDEST), _dropped(0),
+      _steps(0), _delivered(0),
+      _lockstep(false), _lockstep_policy(LOCKSTEP_CONTINUE),
+      _lockstep_timeouts(0), _lockstep_seq(0)
 {
+    pthread_condattr_t attr;
+
     pthread_mutex_init(&_lock_sess, NULL);
-    pthread_mutex_init(&_lock_to_join, NULL);
+    pthread_mutex_init(&_lock_msgs, NULL);
+    pthread_mutex_init(&_lock_step, NULL);
+
+    // deadlines are computed from sim::Time::cur()
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&_cond_step, &attr);
+    pthread_condattr_destroy(&attr);
 }
 
 RServer::~RServer()
 {
     pthread_mutex_destroy(&_lock_sess);
-    pthread_mutex_destroy(&_lock_to_join);
+    pthread_mutex_destroy(&_lock_msgs);
+    pthread_mutex_destroy(&_lock_step);
+    pthread_cond_destroy(&_cond_step);
 }
 
 void RServer::init(Sim *sim)
 {
+    typedef std::list<std::pair<std::string, size_t> > shm_names_t;
     struct sockaddr_in addr;
+    struct epoll_event ev;
+    RServerShmSession *shm;
+    int opt;
 
     // create tcp socket
     _sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -353,11 +1007,21 @@ void RServer::init(Sim *sim)
         return;
     }
 
+    opt = 1;
+    setsockopt(_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
     memset(&addr, 0, sizeof(addr));
 
     addr.sin_family = AF_INET;
     addr.sin_port = htons(_port);
-    addr.sin_addr.s_addr = INADDR_ANY; // TODO
+    if (_addr == "any" || _addr.size() == 0){
+        addr.sin_addr.s_addr = INADDR_ANY;
+    }else if (inet_pton(AF_INET, _addr.c_str(), &addr.sin_addr) != 1){
+        ERR("RServer: Invalid address " << _addr);
+        close(_sock);
+        _sock = -1;
+        return;
+    }
 
     if(bind(_sock,(struct sockaddr *)&addr, sizeof(addr)) < 0){
         perror("RServer: ");
@@ -372,146 +1036,417 @@ void RServer::init(Sim *sim)
         _sock = -1;
         return;
     }
+    setNonBlocking(_sock);
+
+    _epfd = epoll_create(SIM_RSERVER_MAX_EVENTS);
+    _wakefd = eventfd(0, EFD_NONBLOCK);
+    if (_epfd < 0 || _wakefd < 0){
+        ERR("RServer: Can not create epoll or eventfd descriptor.");
+        finish();
+        return;
+    }
+
+    // listening socket and wake up descriptor are distinguished from
+    // sessions by data.ptr
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &_sock;
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, _sock, &ev);
+    ev.data.ptr = &_wakefd;
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, _wakefd, &ev);
+
+    if (_unix_path.size() > 0){
+        _unix_sock = _listenUnix();
+        if (_unix_sock >= 0){
+            ev.data.ptr = &_unix_sock;
+            epoll_ctl(_epfd, EPOLL_CTL_ADD, _unix_sock, &ev);
+        }
+    }
+
+    for_each(shm_names_t::iterator, _shm_names){
+        shm = new RServerShmSession(this, it->first.c_str(), it->second);
+        if (!shm->valid()){
+            delete shm;
+            continue;
+        }
+        shm->setQueueLimit(_queue_max, _overflow);
+        _sessions.push_back(shm);
+    }
+
+    _quit = false;
+    if (pthread_create(&_th, NULL, _ioThread, (void *)this) != 0){
+        ERR("RServer: Can not create I/O thread.");
+        finish();
+        return;
+    }
+    _th_running = true;
 
     sim->regPreStep(this);
+    sim->regPostStep(this);
     sim->regMessage(this, RMessageOut::Type);
     _sim = sim;
 }
 
-void RServer::finish()
+void RServer::addUnix(const char *path)
 {
-    std::list<RServerSession *>::iterator it, it_end;
+    _unix_path = path;
+}
+
+int RServer::_listenUnix()
+{
+    struct sockaddr_un addr;
+    int sock;
+
+    if (_unix_path.size() >= sizeof(addr.sun_path)){
+        ERR("RServer: Too long path " << _unix_path);
+        return -1;
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0){
+        ERR("RServer: Can not create unix socket.");
+        return -1;
+    }
 
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, _unix_path.c_str());
+
+    // remove socket left by previous run
+    unlink(_unix_path.c_str());
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || listen(sock, 10) < 0){
+        perror("RServer: ");
+        close(sock);
+        return -1;
+    }
+    setNonBlocking(sock);
+
+    MSG("RServer: Listening on unix socket " << _unix_path);
+    return sock;
+}
+
+void RServer::addShm(const char *name, size_t size)
+{
+    _shm_names.push_back(std::make_pair(std::string(name), size));
+}
+
+void RServer::finish()
+{
     DBG("");
 
-    pthread_mutex_lock(&_lock_sess);
-    pthread_mutex_lock(&_lock_to_join);
-    it = _sessions.begin();
-    it_end = _sessions.end();
-    for (; it != it_end; ++it){
-        DBG(*it);
-        (*it)->cancel();
-        _sessions_to_join.push_back(*it);
+    if (_th_running){
+        _quit = true;
+        _wake();
+        pthread_join(_th, NULL);
+        _th_running = false;
+    }
+
+    // I/O thread is not running anymore, no locking is needed
+    for_each(std::list<RServerSession *>::iterator, _sessions){
+        delete *it;
     }
     _sessions.clear();
-    pthread_mutex_unlock(&_lock_to_join);
-    pthread_mutex_unlock(&_lock_sess);
 
-    _joinSessions();
+    for_each(std::list<RMessage *>::iterator, _msgs_to_deliver){
+        delete *it;
+    }
+    _msgs_to_deliver.clear();
 
-    if (_sock > 0){
+    if (_wakefd >= 0)
+        close(_wakefd);
+    if (_epfd >= 0)
+        close(_epfd);
+    if (_sock >= 0){
         shutdown(_sock, SHUT_RDWR);
         close(_sock);
     }
+    if (_unix_sock >= 0){
+        close(_unix_sock);
+        unlink(_unix_path.c_str());
+    }
+    _wakefd = _epfd = _sock = _unix_sock = -1;
 }
 
 void RServer::cbPreStep()
 {
-    // check for new connections
-    _newConnections();
+    // wait until all clients in lockstep sent requests for this step
+    if (_lockstep)
+        _waitClients();
+
+    // read requests from sessions not served by I/O thread
+    _pollSessions();
 
     // deliver all messages
     _deliverMsgs();
+}
+
+void RServer::cbPostStep()
+{
+    ++_steps;
 
-    // join ended sessions
-    _joinSessions();
+    // answer requests of subscribed streams
+    _pushSubscriptions();
+
+    // let clients in lockstep know the step is over
+    if (_lockstep)
+        _stepSessions();
+
+    // hand all replies produced during this step over to I/O thread
+    _commitSessions();
 }
 
 void RServer::processMessage(const sim::Message &msg)
 {
-    RMessageOut *omsg;
-
     if (msg.type() == RMessageOut::Type){
-        omsg = (RMessageOut *)&msg;
-        _sendRMessage((const RMessageOut &)omsg);
+        _sendRMessage((const RMessageOut &)msg);
     }
 }
 
-void RServer::_newConnections()
+void *RServer::_ioThread(void *s)
+{
+    ((RServer *)s)->_ioLoop();
+    return NULL;
+}
+
+void RServer::_ioLoop()
 {
-    fd_set fds;
-    int ready, maxfd, connfd;
-    struct timeval timeout;
+    struct epoll_event evs[SIM_RSERVER_MAX_EVENTS];
+    std::list<RServerSession *> to_close;
+    RServerSession *sess;
+    uint64_t val;
+    int i, num;
+
+    while (!_quit){
+        num = epoll_wait(_epfd, evs, SIM_RSERVER_MAX_EVENTS, -1);
+        if (num < 0){
+            if (errno == EINTR)
+                continue;
+            perror("RServer: epoll_wait()");
+            break;
+        }
+
+        for (i = 0; i < num; i++){
+            if (evs[i].data.ptr == &_sock){
+                _acceptConnections(_sock, true);
+
+            }else if (evs[i].data.ptr == &_unix_sock){
+                _acceptConnections(_unix_sock, false);
+
+            }else if (evs[i].data.ptr == &_wakefd){
+                while (read(_wakefd, &val, sizeof(val)) > 0);
+                _flushSessions(to_close);
+
+            }else{
+                sess = (RServerSession *)evs[i].data.ptr;
+                if (sess->closed())
+                    continue;
+
+                if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+                    if (sess->readInput() != 0){
+                        _closeSession(sess, to_close);
+                        continue;
+                    }
+                }
+
+                if (evs[i].events & EPOLLOUT){
+                    _writeSession(sess, to_close);
+                }
+            }
+        }
+
+        // sessions are deleted after all events were processed because
+        // more events of one epoll_wait() can refer to the same session
+        for_each(std::list<RServerSession *>::iterator, to_close){
+            delete *it;
+        }
+        to_close.clear();
+    }
+}
 
-    FD_ZERO(&fds);
-    FD_SET(_sock, &fds);
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 1;
+void RServer::_wake()
+{
+    uint64_t val = 1;
+    if (write(_wakefd, &val, sizeof(val)) != sizeof(val)){
+        DBG("Can not wake up I/O thread");
+    }
+}
 
+void RServer::_acceptConnections(int sock, bool tcp)
+{
+    struct epoll_event ev;
+    RServerSession *sess;
+    int connfd, opt;
 
-    maxfd = _sock + 1;
-    ready = select(maxfd, &fds, NULL, NULL, &timeout);
-    if (ready > 0){
-        connfd = accept(_sock, NULL, NULL);
+    while (true){
+        connfd = accept(sock, NULL, NULL);
         if (connfd < 0){
-            perror("accept() error");
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept() error");
             return;
         }
 
+        setNonBlocking(connfd);
+
+        // replies are coalesced by server itself, so there is no reason
+        // to let Nagle delay them
+        if (tcp){
+            opt = 1;
+            setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        }
+
         DBG("New connection " << connfd);
-        _addSession(connfd);
+        sess = new RServerSession(this, connfd);
+        sess->setQueueLimit(_queue_max, _overflow);
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = sess;
+        if (epoll_ctl(_epfd, EPOLL_CTL_ADD, connfd, &ev) != 0){
+            perror("RServer: epoll_ctl()");
+            delete sess;
+            continue;
+        }
+
+        pthread_mutex_lock(&_lock_sess);
+        _sessions.push_back(sess);
+        pthread_mutex_unlock(&_lock_sess);
     }
 }
 
-void RServer::_deliverMsgs()
+void RServer::_flushSessions(std::list<RServerSession *> &to_close)
 {
-    std::list<RMessage *>::iterator it, it_end;
+    std::list<RServerSession *> sessions;
 
-    pthread_mutex_lock(&_lock_msgs);
+    // sessions are removed from the list only by this thread, so a copy
+    // is enough to iterate over without holding the lock
+    pthread_mutex_lock(&_lock_sess);
+    sessions = _sessions;
+    pthread_mutex_unlock(&_lock_sess);
 
-    it = _msgs_to_deliver.begin();
-    it_end = _msgs_to_deliver.end();
-    for (; it != it_end; ++it){
-        DBG("");
-        _sim->sendMessage(*it);
+    for_each(std::list<RServerSession *>::iterator, sessions){
+        if ((*it)->closed() || (*it)->polled())
+            continue;
+
+        if ((*it)->overflowed()){
+            MSG("RServer: Disconnecting client with full queue.");
+            _closeSession(*it, to_close);
+        }else if ((*it)->kicked()){
+            MSG("RServer: Disconnecting client late in lockstep.");
+            _closeSession(*it, to_close);
+        }else if (!(*it)->wantOut()){
+            _writeSession(*it, to_close);
+        }
     }
-    _msgs_to_deliver.clear();
-
-    pthread_mutex_unlock(&_lock_msgs);
 }
 
-void RServer::_joinSessions()
+void RServer::_writeSession(RServerSession *sess,
+                            std::list<RServerSession *> &to_close)
 {
-    std::list<RServerSession *>::iterator it, it_end;
+    struct epoll_event ev;
+    int ret;
 
-    pthread_mutex_lock(&_lock_to_join);
-
-    it = _sessions_to_join.begin();
-    it_end = _sessions_to_join.end();
-    for (; it != it_end; ++it){
-        DBG(*it);
-        delete *it;
+    ret = sess->writeOutput();
+    if (ret < 0){
+        _closeSession(sess, to_close);
+        return;
     }
-    _sessions_to_join.clear();
 
-    pthread_mutex_unlock(&_lock_to_join);
+    // watch for EPOLLOUT only while there is something left in queue
+    if ((ret == 1) != sess->wantOut()){
+        sess->setWantOut(ret == 1);
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        if (ret == 1)
+            ev.events |= EPOLLOUT;
+        ev.data.ptr = sess;
+        epoll_ctl(_epfd, EPOLL_CTL_MOD, sess->sock(), &ev);
+    }
 }
 
-void RServer::_addSession(int sock)
+void RServer::_closeSession(RServerSession *sess,
+                            std::list<RServerSession *> &to_close)
 {
-    RServerSession *sess;
+    unsigned long dropped;
 
-    sess = new RServerSession(this, sock);
+    dropped = sess->dropped();
+    DBG(sess << " queue peak: " << sess->queuePeak()
+             << " dropped: " << dropped);
 
     pthread_mutex_lock(&_lock_sess);
-    _sessions.push_back(sess);
+    _sessions.remove(sess);
+    _dropped += dropped;
     pthread_mutex_unlock(&_lock_sess);
 
-    sess->run();
+    epoll_ctl(_epfd, EPOLL_CTL_DEL, sess->sock(), NULL);
+    sess->setClosed();
+    to_close.push_back(sess);
+
+    // simulation could wait on the client
+    __stepDone();
+}
+
+void RServer::_deliverMsgs()
+{
+    std::list<RMessage *> msgs;
+
+    pthread_mutex_lock(&_lock_msgs);
+    msgs.swap(_msgs_to_deliver);
+    ++_delivered;
+    pthread_mutex_unlock(&_lock_msgs);
+
+    _deliver(msgs);
+}
+
+void RServer::_deliver(std::list<RMessage *> &msgs)
+{
+    std::map<uint16_t, sim::Component *>::iterator ep;
+
+    for_each(std::list<RMessage *>::iterator, msgs){
+        // requests addressed to registered endpoint are passed directly to
+        // it, others are broadcast to all interested components
+        ep = _endpoints.find((*it)->msgID());
+        if (ep != _endpoints.end()){
+            ep->second->processMessage(**it);
+            delete *it;
+        }else{
+            _sim->sendMessage(*it);
+        }
+    }
+}
+
+void RServer::regEndpoint(uint16_t id, sim::Component *c)
+{
+    _endpoints[id] = c;
+}
+
+void RServer::unregEndpoint(uint16_t id)
+{
+    _endpoints.erase(id);
+}
+
+void RServer::sendReply(RMessageOut *msg)
+{
+    _sendRMessage(*msg);
+    delete msg;
 }
 
-void RServer::__addSessionToJoin(RServerSession *sess)
+unsigned long RServer::dropped()
 {
+    unsigned long ret;
+
     pthread_mutex_lock(&_lock_sess);
-    _sessions.remove(sess);
+    ret = _dropped;
+    for_each(std::list<RServerSession *>::iterator, _sessions){
+        ret += (*it)->dropped();
+    }
     pthread_mutex_unlock(&_lock_sess);
 
-    pthread_mutex_lock(&_lock_to_join);
-    if (std::find(_sessions_to_join.begin(), _sessions_to_join.end(), sess)
-            == _sessions_to_join.end()){
-        _sessions_to_join.push_back(sess);
-    }
-    pthread_mutex_unlock(&_lock_to_join);
+    return ret;
 }
 
 void RServer::__addMessage(RMessage *msg)
@@ -519,21 +1454,257 @@ void RServer::__addMessage(RMessage *msg)
     pthread_mutex_lock(&_lock_msgs);
     _msgs_to_deliver.push_back(msg);
     pthread_mutex_unlock(&_lock_msgs);
+
+    if (_lockstep)
+        __stepDone();
+}
+
+void RServer::__addMessages(std::list<RMessage *> &msgs)
+{
+    if (msgs.empty())
+        return;
+
+    pthread_mutex_lock(&_lock_msgs);
+    _msgs_to_deliver.splice(_msgs_to_deliver.end(), msgs);
+    pthread_mutex_unlock(&_lock_msgs);
+
+    // simulation waiting in lockstep answers requests right away
+    if (_lockstep)
+        __stepDone();
+}
+
+unsigned long RServer::__addBatch(std::list<RMessage *> &msgs)
+{
+    unsigned long delivered;
+
+    pthread_mutex_lock(&_lock_msgs);
+    _msgs_to_deliver.splice(_msgs_to_deliver.end(), msgs);
+    delivered = _delivered;
+    pthread_mutex_unlock(&_lock_msgs);
+
+    if (_lockstep)
+        __stepDone();
+
+    return delivered;
 }
 
 void RServer::_sendRMessage(const RMessageOut &msg)
 {
     std::list<RServerSession *>::iterator it, it_end;
+    bool sent = false;
 
     pthread_mutex_lock(&_lock_sess);
 
+    // reply goes only to clients that talk to the endpoint
     it = _sessions.begin();
     it_end = _sessions.end();
     for (; it != it_end; ++it){
-        (*it)->sendMessage(msg);
+        if ((*it)->addressed(msg.msgID())){
+            (*it)->sendMessage(msg);
+            sent = true;
+        }
+    }
+
+    // nobody asked (e.g., message produced by component on its own), so
+    // let everyone know
+    if (!sent){
+        for (it = _sessions.begin(); it != it_end; ++it){
+            (*it)->sendMessage(msg);
+        }
+    }
+
+    pthread_mutex_unlock(&_lock_sess);
+}
+
+void RServer::_pollSessions()
+{
+    pthread_mutex_lock(&_lock_sess);
+    for_each(std::list<RServerSession *>::iterator, _sessions){
+        if ((*it)->polled())
+            (*it)->readInput();
+    }
+    pthread_mutex_unlock(&_lock_sess);
+}
+
+void RServer::_commitSessions()
+{
+    std::list<RServerSession *>::iterator it, it_end;
+    unsigned long delivered;
+    bool wake = false;
+
+    pthread_mutex_lock(&_lock_msgs);
+    delivered = _delivered;
+    pthread_mutex_unlock(&_lock_msgs);
+
+    pthread_mutex_lock(&_lock_sess);
+
+    it = _sessions.begin();
+    it_end = _sessions.end();
+    for (; it != it_end; ++it){
+        if (!(*it)->commit(delivered, _steps))
+            continue;
+
+        if ((*it)->polled()){
+            (*it)->writeOutput();
+        }else{
+            wake = true;
+        }
     }
 
     pthread_mutex_unlock(&_lock_sess);
+
+    if (wake)
+        _wake();
+}
+
+void RServer::_pushSubscriptions()
+{
+    std::vector<uint32_t> reqs;
+    std::vector<uint32_t>::iterator last;
+    std::list<RMessage *> msgs;
+
+    pthread_mutex_lock(&_lock_sess);
+    for_each(std::list<RServerSession *>::iterator, _sessions){
+        (*it)->dueSubscriptions(_steps, reqs);
+    }
+    pthread_mutex_unlock(&_lock_sess);
+
+    if (reqs.empty())
+        return;
+
+    // replies are sent to all sessions that address the endpoint, so the
+    // same request subscribed by more clients is issued only once
+    std::sort(reqs.begin(), reqs.end());
+    last = std::unique(reqs.begin(), reqs.end());
+    for (std::vector<uint32_t>::iterator it = reqs.begin(); it != last; ++it){
+        msgs.push_back(newRequest(*it >> 8, *it & 0xff));
+    }
+
+    // requests are delivered right away so that replies describe state
+    // after this step and precede MSG_STEP
+    _deliver(msgs);
+}
+
+void RServer::__stepDone()
+{
+    pthread_mutex_lock(&_lock_step);
+    ++_lockstep_seq;
+    pthread_cond_signal(&_cond_step);
+    pthread_mutex_unlock(&_lock_step);
+}
+
+void RServer::_waitClients()
+{
+    sim::Time start, deadline, wake;
+    struct timespec ts;
+    unsigned long seq;
+    bool polled;
+
+    start = sim::Time::cur();
+    deadline = start;
+    deadline += _lockstep_timeout;
+
+    while (true){
+        pthread_mutex_lock(&_lock_step);
+        seq = _lockstep_seq;
+        pthread_mutex_unlock(&_lock_step);
+
+        // answer requests clients sent after MSG_STEP, they could wait
+        // for replies before sending MSG_STEP_DONE
+        _deliverMsgs();
+        _commitSessions();
+
+        if (_clientsReady(&polled))
+            break;
+
+        if (_lockstep_timeout > sim::Time() && sim::Time::cur() >= deadline){
+            DBG("Lockstep timeout in step " << _steps);
+            ++_lockstep_timeouts;
+            _timeoutClients();
+            break;
+        }
+
+        // polled sessions can't wake us up, so they are checked
+        // periodically
+        wake = deadline;
+        if (polled){
+            wake = sim::Time::cur();
+            wake += sim::Time(0, SIM_RSERVER_LOCKSTEP_POLL);
+            if (_lockstep_timeout > sim::Time() && wake > deadline)
+                wake = deadline;
+        }
+        ts.tv_sec  = wake.inS();
+        ts.tv_nsec = wake.inNs() % 1000000000L;
+
+        pthread_mutex_lock(&_lock_step);
+        if (seq == _lockstep_seq){
+            if (polled || _lockstep_timeout > sim::Time()){
+                pthread_cond_timedwait(&_cond_step, &_lock_step, &ts);
+            }else{
+                pthread_cond_wait(&_cond_step, &_lock_step);
+            }
+        }
+        pthread_mutex_unlock(&_lock_step);
+
+        if (polled)
+            _pollSessions();
+    }
+
+    _lockstep_wait += sim::Time::diff(start, sim::Time::cur());
+}
+
+bool RServer::_clientsReady(bool *polled)
+{
+    bool ready = true;
+
+    *polled = false;
+
+    pthread_mutex_lock(&_lock_sess);
+    for_each(std::list<RServerSession *>::iterator, _sessions){
+        if (!(*it)->lockstepReady(_steps)){
+            ready = false;
+            if ((*it)->polled())
+                *polled = true;
+        }
+    }
+    pthread_mutex_unlock(&_lock_sess);
+
+    return ready;
+}
+
+void RServer::_timeoutClients()
+{
+    bool wake = false;
+
+    if (_lockstep_policy == LOCKSTEP_CONTINUE)
+        return;
+
+    pthread_mutex_lock(&_lock_sess);
+    for_each(std::list<RServerSession *>::iterator, _sessions){
+        if ((*it)->lockstepReady(_steps))
+            continue;
+
+        // shared memory segment can't be disconnected, its client is only
+        // released
+        if (_lockstep_policy == LOCKSTEP_DISCONNECT && !(*it)->polled()){
+            (*it)->kick();
+            wake = true;
+        }
+        (*it)->lockstepRelease();
+    }
+    pthread_mutex_unlock(&_lock_sess);
+
+    if (wake)
+        _wake();
+}
+
+void RServer::_stepSessions()
+{
+    pthread_mutex_lock(&_lock_sess);
+    for_each(std::list<RServerSession *>::iterator, _sessions){
+        (*it)->sendStep(_steps);
+    }
+    pthread_mutex_unlock(&_lock_sess);
 }
 
 }
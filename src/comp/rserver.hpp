@@ -25,13 +25,34 @@
 #include <string>
 #include <stdint.h>
 #include <vector>
+#include <list>
+#include <deque>
+#include <set>
+#include <map>
+#include <pthread.h>
 #include <sim/config.hpp>
 #include <sim/component.hpp>
 #include <sim/math.hpp>
+#include <sim/time.hpp>
 #include <sim/sensor/rangefinder.hpp>
 #include <sim/sensor/camera.hpp>
+#include <osg/Image>
 
 #define SIM_RSERVER_BUFSIZE 4096
+#define SIM_RSERVER_MAX_EVENTS 32 /*!< Max. events per epoll_wait() */
+#define SIM_RSERVER_MAX_IOV 64 /*!< Max. messages per one sendmsg() */
+#define SIM_RSERVER_QUEUE_LEN 64 /*!< Default limit of outbound queue */
+#define SIM_RSERVER_SHM_SIZE (1024 * 1024) /*!< Default size of shm ring,
+                                                 replies bigger than ring
+                                                 (e.g., MSG_IMG of camera
+                                                 with more than ~349k
+                                                 pixels) are dropped */
+#define SIM_RSERVER_BATCH_WAIT 3 /*!< Max. number of steps replies to
+                                      batch are collected */
+#define SIM_RSERVER_LOCKSTEP_TIMEOUT 1000 /*!< Default lockstep timeout
+                                              in ms */
+#define SIM_RSERVER_LOCKSTEP_POLL 100000 /*!< How often (in ns) are polled
+                                              sessions checked in lockstep */
 
 namespace sim {
 
@@ -39,6 +60,14 @@ namespace comp {
 
 class RServer;
 
+/**
+ * Message of remote protocol.
+ *
+ * ID of message identifies endpoint (usually a robot) the request is
+ * addressed to and replies carry ID of endpoint that produced them. This
+ * way one server can serve any number of robots (see
+ * RServer::regEndpoint()).
+ */
 class RMessage : public sim::Message {
   private:
     uint16_t _id;
@@ -64,7 +93,11 @@ class RMessage : public sim::Message {
         MSG_GET_RF        = 9,
         MSG_RF            = 10,
         MSG_GET_IMG       = 11,
-        MSG_IMG           = 12
+        MSG_IMG           = 12,
+        MSG_SUBSCRIBE     = 13, /*!< [type of request, uint16 period] */
+        MSG_BATCH         = 14, /*!< [uint16 count, count whole messages] */
+        MSG_STEP_DONE     = 15, /*!< [uint32 step] */
+        MSG_STEP          = 16  /*!< [uint32 step] */
     };
 };
 
@@ -194,93 +227,431 @@ class RMessageOutRF : public RMessageOut {
     const std::vector<Scalar> &distance() const { return _dist; }
 };
 
+/**
+ * Image reply. Message only references camera's image (which can't change
+ * while messages are delivered) and the image is converted to protocol's
+ * BGR format directly into session's output buffer by pack().
+ */
 class RMessageOutImg : public RMessageOut {
     uint16_t _width, _height;
-    unsigned char *_data;
+    osg::ref_ptr<const osg::Image> _img;
 
   public:
     RMessageOutImg(uint16_t id, const sim::sensor::Camera &cam);
-    ~RMessageOutImg();
 
     uint16_t width() const { return _width; }
     uint16_t height() const { return _height; }
-    const unsigned char *data() const { return _data; }
+
+    /**
+     * Writes 3 * width() * height() bytes of BGR image to dst.
+     */
+    void pack(unsigned char *dst) const;
 };
 
 
 
 
+/**
+ * One connected client.
+ *
+ * Session is driven by RServer's I/O thread which reads requests from
+ * non-blocking socket and writes out queued replies. Replies are
+ * serialized by sendMessage() in simulation thread and handed over to I/O
+ * thread by commit(). Outbound queue is bounded, what happens when it is
+ * full is driven by overflow policy.
+ *
+ * Sessions that are not backed by socket (see RServerShmSession) are
+ * polled by simulation thread instead.
+ */
 class RServerSession {
+  public:
+    enum Overflow {
+        OVERFLOW_DROP_OLDEST, /*!< Oldest unsent message is dropped */
+        OVERFLOW_DROP_NEW, /*!< New message is dropped */
+        OVERFLOW_DISCONNECT /*!< Client is disconnected */
+    };
+
   protected:
     RServer *_server;
     int _sock;
-    pthread_t _th;
+    bool _closed; //!< True if session is about to be deleted
+    bool _want_out; //!< True if socket is watched for EPOLLOUT
+
     char _buf[SIM_RSERVER_BUFSIZE];
-    char *_bufstart, *_bufend;
+    std::vector<char> _in; //!< Received but not yet parsed data
+
+    std::vector<char> _out; //!< Serialization buffer
+    std::list<std::vector<char> *> _pending; //!< Serialized messages not
+                                             //!< yet committed
+    std::deque<std::vector<char> *> _queue; //!< Messages waiting for I/O
+                                            //!< thread
+    size_t _queue_off; //!< Already sent bytes of _queue.front()
+    size_t _queue_max; //!< Max. length of _queue
+    Overflow _overflow; //!< Overflow policy
+    bool _overflowed; //!< True if queue overflowed under DISCONNECT policy
+    unsigned long _dropped; //!< Number of dropped messages
+    size_t _queue_peak; //!< Max. reached length of _queue
+    pthread_mutex_t _lock; //!< Lock for _queue, counters, _subs and
+                           //!< lockstep state
+
+    struct sub_t {
+        uint16_t id;
+        char type; //!< Type of request
+        uint16_t period; //!< Period in steps
+    };
+    std::list<sub_t> _subs; //!< Subscribed streams
+    std::set<uint16_t> _ids; //!< Endpoints the client talks to
+
+    struct batch_t {
+        uint16_t id; //!< ID of batch request
+        unsigned long gen; //!< Delivery in which batch was received
+        bool delivered; //!< True if requests were delivered
+        unsigned long due; //!< Step in which batch is sent at the latest
+        std::list<uint32_t> replies; //!< Expected replies (id << 8 | type)
+        uint16_t count; //!< Number of collected replies
+        std::vector<char> msg; //!< Collected replies
+    };
+    std::list<batch_t> _batches; //!< Batch requests in order of arrival
+
+    bool _lockstep; //!< True if client takes part in lockstep
+    bool _lockstep_join; //!< True if client has just joined lockstep
+    unsigned long _step_done; //!< Last step client is done with
+    bool _kicked; //!< True if client should be disconnected
 
   public:
     RServerSession(RServer *server, int sock);
-    ~RServerSession();
+    virtual ~RServerSession();
+
+    /**
+     * Returns true if session is not served by I/O thread but
+     * readInput() and writeOutput() are called directly from simulation
+     * thread.
+     */
+    virtual bool polled() const { return false; }
+
+    int sock() const { return _sock; }
+    bool closed() const { return _closed; }
+    void setClosed() { _closed = true; }
+    bool wantOut() const { return _want_out; }
+    void setWantOut(bool w) { _want_out = w; }
+
+    /**
+     * Sets max. number of messages waiting in outbound queue and what to
+     * do if the limit is reached.
+     * Control frames (MSG_STEP and MSG_BATCH replies) are never dropped
+     * and can exceed the limit.
+     */
+    void setQueueLimit(size_t max, Overflow policy);
+
+    /**
+     * Returns true if session should be disconnected because its queue
+     * overflowed.
+     */
+    bool overflowed();
+
+    /**
+     * Current number of messages in outbound queue.
+     */
+    size_t queueDepth();
+
+    /**
+     * Max. number of messages that was ever in outbound queue.
+     */
+    size_t queuePeak();
+
+    /**
+     * Number of messages dropped because of full queue.
+     */
+    unsigned long dropped();
+
+    /**
+     * Returns true if client sent any request to endpoint of given id.
+     */
+    bool addressed(uint16_t id);
+
+    /**
+     * Returns true if client doesn't hold up given step, i.e., it isn't
+     * in lockstep or it is done with the previous step.
+     */
+    bool lockstepReady(unsigned long step);
+
+    /**
+     * Removes client from lockstep until it sends MSG_STEP_DONE again.
+     */
+    void lockstepRelease();
+
+    /**
+     * Serializes MSG_STEP if client is in lockstep.
+     */
+    void sendStep(unsigned long step);
+
+    /**
+     * Marks session to be disconnected by I/O thread.
+     */
+    void kick();
+    bool kicked();
+
+    /**
+     * Fills list of requests (id << 8 | type) of subscriptions that are
+     * due in given step.
+     */
+    void dueSubscriptions(unsigned long step, std::vector<uint32_t> &reqs);
+
+    /**
+     * Serializes message. Nothing is sent until commit() is called.
+     */
+    void sendMessage(const RMessageOut &msg);
 
-    void run();
-    void cancel();
+    /**
+     * Hands all serialized messages over to I/O thread applying overflow
+     * policy. Returns true if I/O thread has something to do.
+     *
+     * Replies to each delivered batch request (see RServer::__addBatch())
+     * are collected and sent wrapped in one MSG_BATCH reply when all of
+     * them arrived or SIM_RSERVER_BATCH_WAIT steps after delivery. All
+     * other messages are sent on their own.
+     */
+    bool commit(unsigned long delivered, unsigned long step);
+
+    /**
+     * Reads all available data from socket and passes parsed messages to
+     * server. Returns -1 if connection was closed.
+     */
+    virtual int readInput();
+
+    /**
+     * Writes as much of queued messages as socket accepts.
+     * Returns -1 on error, 1 if some data remain in queue and 0 if queue
+     * was emptied.
+     */
+    virtual int writeOutput();
 
-    void sendMessage(const RMessageOut &msg);
+  protected:
+    void _parseInput();
+    void _address(uint16_t id);
+    void _dropQueue();
 
   private:
-    static void *thread(void *);
-
-    int _readByte(char *c);
-    int _readID(uint16_t *id);
-    int _readType(char *type);
-    int _readFloat(float *f);
+    void _parseMessage(const char *data, std::list<RMessage *> &msgs);
+    void _subscribe(uint16_t id, char type, uint16_t period);
+    void _stepDone(unsigned long step);
+    size_t _messageSize(const char *data, size_t len) const;
+    size_t _payloadSize(char type) const;
+    float _parseFloat(const char *c) const;
 
     int _writeID(uint16_t id);
     int _writeType(char type);
     int _writeByte(char b);
     int _writeUInt16(uint16_t i);
+    int _writeUInt32(uint32_t i);
     int _writeFloat(float f);
+    int _writeData(const void *data, size_t len);
 };
 
+/**
+ * Remote server.
+ *
+ * All network communication is done in one I/O thread running epoll loop,
+ * so number of threads does not depend on number of clients. Simulation
+ * thread only delivers received messages (cbPreStep()) and commits
+ * replies to sessions (cbPostStep()).
+ *
+ * Requests of subscribed streams (MSG_SUBSCRIBE) are issued and delivered
+ * to endpoints in cbPostStep() of step N, so replies describe state after
+ * step N and are sent in the same step, i.e., in lockstep they arrive
+ * before MSG_STEP N. Replies of components that are not endpoints (or
+ * don't use sendReply()) come one step later.
+ */
 class RServer : public sim::Component {
+  public:
+    enum LockstepTimeout {
+        LOCKSTEP_CONTINUE, /*!< Step is performed without late clients */
+        LOCKSTEP_RELEASE, /*!< Late clients are removed from lockstep */
+        LOCKSTEP_DISCONNECT /*!< Late clients are disconnected */
+    };
+
   protected:
     sim::Sim *_sim;
 
     std::string _addr;
     uint16_t _port;
     int _sock;
+    std::string _unix_path; //!< Path of unix socket, empty if not used
+    int _unix_sock;
+    int _epfd; //!< epoll descriptor
+    int _wakefd; //!< eventfd used for waking up I/O thread
+
+    pthread_t _th; //!< I/O thread
+    bool _th_running;
+    volatile bool _quit;
 
     std::list<RServerSession *> _sessions; /*!< List of active sessions */
-    std::list<RServerSession *> _sessions_to_join; /*!< List of sessions that
-                                                        should be joined and
-                                                        closed */
     std::list<RMessage *> _msgs_to_deliver; /*!< List of messages to
                                                  deliver */
+    size_t _queue_max; //!< Limit of sessions' outbound queues
+    RServerSession::Overflow _overflow; //!< Sessions' overflow policy
+    unsigned long _dropped; //!< Messages dropped by closed sessions
+    unsigned long _steps; //!< Number of finished steps
+    unsigned long _delivered; //!< Number of _deliverMsgs() calls
+
+    std::list<std::pair<std::string, size_t> > _shm_names; //!< Requested
+                                                           //!< shm segments
+    std::map<uint16_t, sim::Component *> _endpoints; //!< Handlers of
+                                                     //!< endpoints
+
+    bool _lockstep; //!< True if lockstep mode is enabled
+    sim::Time _lockstep_timeout; //!< Max. time of waiting, zero for no limit
+    LockstepTimeout _lockstep_policy; //!< What to do with late clients
+    sim::Time _lockstep_wait; //!< Overall time spent waiting on clients
+    unsigned long _lockstep_timeouts; //!< Number of timed out steps
+    unsigned long _lockstep_seq; //!< Incremented on each MSG_STEP_DONE
+                                 //!< and on each new request
+    pthread_mutex_t _lock_step;
+    pthread_cond_t _cond_step;
 
     pthread_mutex_t _lock_sess;
-    pthread_mutex_t _lock_to_join; /*!< Lock for _sessions_to_join */
     pthread_mutex_t _lock_msgs;
 
   public:
+    /**
+     * Creates server listening on given IPv4 address ("any" for all
+     * interfaces) and port.
+     */
     RServer(const char *addr, uint16_t port);
     ~RServer();
 
     virtual void init(Sim *sim);
     virtual void finish();
     virtual void cbPreStep();
+    virtual void cbPostStep();
     virtual void processMessage(const sim::Message &msg);
 
-    void __addSessionToJoin(RServerSession *sess);
+    /**
+     * Sets limit of outbound queue of each session and overflow policy.
+     * Must be called before init().
+     * Default is SIM_RSERVER_QUEUE_LEN messages and OVERFLOW_DROP_OLDEST.
+     */
+    void setQueueLimit(size_t max, RServerSession::Overflow policy)
+        { _queue_max = max; _overflow = policy; }
+
+    /**
+     * Returns total number of messages dropped because of full queues.
+     */
+    unsigned long dropped();
+
+    /**
+     * Enables lockstep mode. Must be called before init().
+     *
+     * Clients join lockstep by sending MSG_STEP_DONE. Before each step
+     * server waits until all joined clients are done with previous step,
+     * so requests they sent for the step are all delivered in it. After
+     * each step MSG_STEP is sent to all joined clients.
+     *
+     * Requests received while waiting are delivered and answered right
+     * away, so client can ask for state after the step (e.g., MSG_GET_POS)
+     * between MSG_STEP and MSG_STEP_DONE. This holds for endpoints that
+     * reply by sendReply(), replies sent by Sim::sendMessage() come only
+     * after the next step.
+     *
+     * If timeout is non-zero and clients don't answer in time, the step
+     * is performed anyway and late clients are treated according to
+     * policy. Zero timeout means waiting forever. Note that simulation
+     * waits with the step lock held, so rendering and Sim::done() are
+     * blocked meanwhile.
+     *
+     * Together with Sim::setSimulateReal(false) simulation runs as fast
+     * as clients allow.
+     */
+    void setLockstep(const sim::Time &timeout
+                        = sim::Time::fromMs(SIM_RSERVER_LOCKSTEP_TIMEOUT),
+                     LockstepTimeout policy = LOCKSTEP_RELEASE)
+        { _lockstep = true; _lockstep_timeout = timeout;
+          _lockstep_policy = policy; }
+
+    /**
+     * Overall time simulation spent waiting on clients in lockstep.
+     */
+    const sim::Time &lockstepWait() const { return _lockstep_wait; }
+
+    /**
+     * Number of steps performed after timeout.
+     */
+    unsigned long lockstepTimeouts() const { return _lockstep_timeouts; }
+
+    /**
+     * Registers component as handler of endpoint of given id.
+     * All requests with this id are passed directly to
+     * c->processMessage() instead of being broadcast through Sim, so
+     * component doesn't need to register to RMessageIn* messages.
+     * Requests with id of no registered endpoint are broadcast as before.
+     * Endpoint should answer by sendReply().
+     */
+    void regEndpoint(uint16_t id, sim::Component *c);
+    void unregEndpoint(uint16_t id);
+
+    /**
+     * Sends reply to clients right away, i.e., in the same step as the
+     * request was delivered (and as part of the batch request came in).
+     * Endpoints should use it instead of Sim::sendMessage() that delivers
+     * the reply to server one step later. Takes ownership of msg.
+     */
+    void sendReply(RMessageOut *msg);
+
+    /**
+     * Makes server listen also on unix domain socket of given path.
+     * Must be called before init().
+     */
+    void addUnix(const char *path);
+
+    /**
+     * Adds shared memory transport with given name of segment (see
+     * RServerShmSession). Size of each ring is rounded up to power of
+     * two. Each reply must fit into the ring whole, so size must be
+     * at least 12 + 3 * width * height of the biggest image sent
+     * (MSG_IMG inside MSG_BATCH).
+     * Must be called before init().
+     */
+    void addShm(const char *name, size_t size = SIM_RSERVER_SHM_SIZE);
+
     void __addMessage(RMessage *msg);
+    void __addMessages(std::list<RMessage *> &msgs);
+
+    /**
+     * Adds messages of one batch request. Returns number of deliveries
+     * done so far, i.e., the messages are delivered by the next one.
+     */
+    unsigned long __addBatch(std::list<RMessage *> &msgs);
+
+    /**
+     * Wakes up simulation thread waiting on clients in lockstep.
+     * Called on MSG_STEP_DONE and whenever new requests are added.
+     */
+    void __stepDone();
 
   private:
-    void _newConnections();
+    static void *_ioThread(void *);
+    void _ioLoop();
+    void _wake();
+
+    int _listenUnix();
+    void _acceptConnections(int sock, bool tcp);
+    void _flushSessions(std::list<RServerSession *> &to_close);
+    void _writeSession(RServerSession *sess,
+                       std::list<RServerSession *> &to_close);
+    void _closeSession(RServerSession *sess,
+                       std::list<RServerSession *> &to_close);
     void _deliverMsgs();
-    void _joinSessions();
-
-    void _addSession(int sock);
+    void _deliver(std::list<RMessage *> &msgs);
 
     void _sendRMessage(const RMessageOut &msg);
+    void _pollSessions();
+    void _commitSessions();
+    void _pushSubscriptions();
+
+    void _waitClients();
+    bool _clientsReady(bool *polled);
+    void _timeoutClients();
+    void _stepSessions();
 };
 
 } /* namespace comp */
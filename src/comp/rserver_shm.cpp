@@ -0,0 +1,285 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2011 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include "comp/rserver_shm.hpp"
+#include "msg.hpp"
+#include "sim/common.hpp"
+
+namespace sim {
+namespace comp {
+
+static void futexWake(volatile uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+}
+
+RServerShmSession::RServerShmSession(RServer *server, const char *name,
+                                     size_t size)
+    : RServerSession(server, -1), _shm(0), _len(0), _c2s(0), _s2c(0),
+      _idle(0)
+{
+    void *mem;
+    size_t ring;
+    int fd;
+
+    _name = name;
+    if (_name.size() == 0 || _name[0] != '/')
+        _name = "/" + _name;
+
+    // ring positions are free-running 32-bit counters, so size must be
+    // power of two to keep slots continuous when positions overflow
+    if (size > (1u << 30))
+        size = 1u << 30;
+    for (ring = 1; ring < size; ring <<= 1);
+    size = ring;
+    _len = sizeof(rserver_shm_t) + 2 * size;
+
+    // remove stale segment possibly left by crashed server
+    shm_unlink(_name.c_str());
+    fd = shm_open(_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0){
+        ERR("RServer: Can not create shm segment " << _name);
+        return;
+    }
+
+    if (ftruncate(fd, _len) != 0){
+        ERR("RServer: Can not resize shm segment " << _name);
+        close(fd);
+        shm_unlink(_name.c_str());
+        return;
+    }
+
+    mem = mmap(NULL, _len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED){
+        ERR("RServer: Can not map shm segment " << _name);
+        shm_unlink(_name.c_str());
+        return;
+    }
+
+    _shm = (rserver_shm_t *)mem;
+    memset(_shm, 0, sizeof(rserver_shm_t));
+    _shm->size = size;
+    _c2s = (char *)mem + sizeof(rserver_shm_t);
+    _s2c = _c2s + size;
+
+    __sync_synchronize();
+    _shm->magic  = SIM_RSERVER_SHM_MAGIC;
+    _shm->server = 1;
+
+    MSG("RServer: Listening on shm " << _name);
+}
+
+RServerShmSession::~RServerShmSession()
+{
+    if (!_shm)
+        return;
+
+    // let client know that there is no one to talk to
+    _shm->server = 0;
+    __sync_synchronize();
+    futexWake(&_shm->client);
+    futexWake(&_shm->s2c.head);
+    futexWake(&_shm->c2s.tail);
+
+    munmap(_shm, _len);
+    shm_unlink(_name.c_str());
+}
+
+void RServerShmSession::_attach()
+{
+    DBG(_name);
+
+    // client doesn't touch rings while attaching
+    _shm->c2s.head = _shm->c2s.tail = 0;
+    _shm->s2c.head = _shm->s2c.tail = 0;
+    _in.clear();
+    _idle = 0;
+
+    // nothing of previous client is kept
+    pthread_mutex_lock(&_lock);
+    _dropQueue();
+    _overflowed = false;
+    _subs.clear();
+    _ids.clear();
+    _batches.clear();
+    _lockstep = false;
+    pthread_mutex_unlock(&_lock);
+
+    __sync_synchronize();
+    _shm->client = 1;
+    futexWake(&_shm->client);
+}
+
+void RServerShmSession::_checkClient()
+{
+    pid_t pid = _shm->client_pid;
+
+    // EPERM means the process exists but belongs to someone else
+    if (pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH)
+        return;
+
+    MSG("RServer: shm client " << pid << " is gone, detaching.");
+    _shm->client_pid = 0;
+    __sync_bool_compare_and_swap(&_shm->client, 1, 0);
+    lockstepRelease();
+}
+
+int RServerShmSession::readInput()
+{
+    rserver_shm_ring_t *r;
+    uint32_t head, tail, size, pos, len;
+
+    if (!_shm)
+        return -1;
+
+    if (_shm->client == 2)
+        _attach();
+    if (_shm->client != 1){
+        // detached client can't hold up simulation
+        if (_shm->client == 0)
+            lockstepRelease();
+        return 0;
+    }
+
+    r = &_shm->c2s;
+    size = _shm->size;
+    head = r->head;
+    tail = r->tail;
+    if (head == tail){
+        // client could exit without detaching
+        if (++_idle >= SIM_RSERVER_SHM_ALIVE){
+            _idle = 0;
+            _checkClient();
+        }
+        return 0;
+    }
+    _idle = 0;
+    __sync_synchronize();
+
+    // copy out of ring (possibly in two parts because of wrapping)
+    pos = tail & (size - 1);
+    len = head - tail;
+    if (pos + len > size){
+        _in.insert(_in.end(), _c2s + pos, _c2s + size);
+        _in.insert(_in.end(), _c2s, _c2s + (pos + len - size));
+    }else{
+        _in.insert(_in.end(), _c2s + pos, _c2s + pos + len);
+    }
+
+    __sync_synchronize();
+    r->tail = head;
+    __sync_synchronize();
+    if (r->tail_wait)
+        futexWake(&r->tail);
+
+    _parseInput();
+    return 0;
+}
+
+int RServerShmSession::writeOutput()
+{
+    rserver_shm_ring_t *r;
+    std::vector<char> *buf;
+    uint32_t head, tail, size, pos, len;
+    int ret = 0;
+    bool written = false;
+
+    if (!_shm)
+        return -1;
+
+    pthread_mutex_lock(&_lock);
+
+    // nobody listens or client is too slow
+    if (_shm->client != 1 || _overflowed){
+        if (_overflowed){
+            MSG("RServer: Detaching shm client with full queue.");
+            _shm->client = 0;
+            _overflowed = false;
+        }
+        _dropQueue();
+        pthread_mutex_unlock(&_lock);
+        return 0;
+    }
+
+    r = &_shm->s2c;
+    size = _shm->size;
+    head = r->head;
+
+    while (!_queue.empty()){
+        buf = _queue.front();
+        len = buf->size();
+        tail = r->tail;
+
+        if (len > size){
+            ERR("RServer: Message of " << len << " bytes doesn't fit into"
+                " shm ring " << _name << " (" << size << " bytes), dropped.");
+            ++_dropped;
+            _queue.pop_front();
+            delete buf;
+            continue;
+        }
+
+        // messages are written whole or not at all
+        if (size - (head - tail) < len){
+            ret = 1;
+            break;
+        }
+
+        pos = head & (size - 1);
+        if (pos + len > size){
+            memcpy(_s2c + pos, &(*buf)[0], size - pos);
+            memcpy(_s2c, &(*buf)[size - pos], len - (size - pos));
+        }else{
+            memcpy(_s2c + pos, &(*buf)[0], len);
+        }
+        head += len;
+        written = true;
+
+        _queue.pop_front();
+        delete buf;
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    if (written){
+        __sync_synchronize();
+        r->head = head;
+        __sync_synchronize();
+        if (r->head_wait)
+            futexWake(&r->head);
+    }
+
+    return ret;
+}
+
+} /* namespace comp */
+
+} /* namespace sim */
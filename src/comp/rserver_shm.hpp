@@ -0,0 +1,115 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2011 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_RSERVER_SHM_HPP_
+#define _SIM_RSERVER_SHM_HPP_
+
+#include <string>
+#include <stdint.h>
+#include <sim/comp/rserver.hpp>
+
+#define SIM_RSERVER_SHM_MAGIC 0x53494d52
+#define SIM_RSERVER_SHM_ALIVE 1000 /*!< After how many polls without data
+                                        is checked whether client lives */
+
+namespace sim {
+
+namespace comp {
+
+/**
+ * Single producer single consumer ring buffer in shared memory.
+ * head and tail are positions in bytes that are never wrapped, only their
+ * difference matters. Size of ring is power of two, so position in ring
+ * is (pos & (size - 1)).
+ *
+ * Note that this must be synchronized with /rsim/shm.h!!
+ */
+struct rserver_shm_ring_t {
+    volatile uint32_t head; //!< Written by producer
+    volatile uint32_t head_wait; //!< Consumer sleeps on head
+    char _pad1[56];
+    volatile uint32_t tail; //!< Written by consumer
+    volatile uint32_t tail_wait; //!< Producer sleeps on tail
+    char _pad2[56];
+};
+
+/**
+ * Header of shared memory segment. Data of client-to-server ring follow
+ * the header and data of server-to-client ring follow them.
+ *
+ * Note that this must be synchronized with /rsim/shm.h!!
+ */
+struct rserver_shm_t {
+    uint32_t magic;
+    uint32_t size; //!< Size of data of each ring (power of two)
+    volatile uint32_t server; //!< 1 while server is running
+    volatile uint32_t client; //!< 0 - no client, 2 - client is attaching,
+                              //!< 1 - client is attached
+    volatile uint32_t client_pid; //!< PID of client, 0 if unknown
+    char _pad[44];
+    rserver_shm_ring_t c2s; //!< Client to server
+    rserver_shm_ring_t s2c; //!< Server to client
+};
+
+/**
+ * Session of local client connected through shared memory.
+ *
+ * Only one client can be attached at a time. The session is polled by
+ * simulation thread, requests are read before and replies are written
+ * after each step. No syscall is needed unless client sleeps waiting for
+ * data or it is silent for SIM_RSERVER_SHM_ALIVE polls, then it is
+ * checked that the client process still exists.
+ */
+class RServerShmSession : public RServerSession {
+  protected:
+    std::string _name; //!< Name of shm segment
+    rserver_shm_t *_shm;
+    size_t _len; //!< Length of whole mapped segment
+    char *_c2s, *_s2c; //!< Data of rings
+    unsigned long _idle; //!< Polls without any data from client
+
+  public:
+    RServerShmSession(RServer *server, const char *name, size_t size);
+    ~RServerShmSession();
+
+    /**
+     * Returns false if segment couldn't be created.
+     */
+    bool valid() const { return _shm != 0; }
+
+    bool polled() const { return true; }
+    int readInput();
+    int writeOutput();
+
+  private:
+    void _attach();
+
+    /**
+     * Detaches client that exited (or crashed) without detaching.
+     */
+    void _checkClient();
+};
+
+} /* namespace comp */
+
+} /* namespace sim */
+
+#endif /* _SIM_RSERVER_SHM_HPP_ */
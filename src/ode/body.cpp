@@ -107,6 +107,8 @@ Body::~Body()
         dBodyDestroy(_body);
     if (_vis)
         delete _vis;
+
+    _world->_gridInvalidate();
 }
 
 Body::shape_t *Body::_aShape()
@@ -147,6 +149,7 @@ int Body::_addShape(dGeomID shape, VisBody *vis,
     shape_t *s = new shape_t(shape, vis, pos, rot);
 
     _shapes.insert(_shapes_t::value_type(_next_id, s));
+    _world->_gridInvalidate();
 
     return _next_id++;
 }
@@ -261,6 +264,7 @@ void Body::rmShape(int id)
     delete s;
 
     _shapes.erase(id);
+    _world->_gridInvalidate();
 }
 
 VisBody *Body::visBody(int id)
@@ -328,6 +332,9 @@ void Body::activate()
     _applyPosRot();
     _enableBody();
     _enableVisBody();
+
+    // geoms moved, spatial queries must see them at new position
+    _world->_gridInvalidate();
 }
 
 
@@ -336,6 +343,8 @@ void Body::deactivate()
     _disableVisBody();
     _disableBody();
     _disableShape();
+
+    _world->_gridInvalidate();
 }
 
 void Body::_applyPosRot()
@@ -397,6 +406,7 @@ void Body::_enableVisBody()
 
     for_each(_shapes_it_t, _shapes){
         if (it->second->vis){
+            it->second->vis->setBody(this);
             vw->addBody(it->second->vis);
         }
     }
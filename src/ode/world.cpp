@@ -20,11 +20,21 @@
  */
 
 #include <algorithm>
+#include <cmath>
 
 #include "sim/ode/world.hpp"
 #include "sim/msg.hpp"
 #include "sim/common.hpp"
 
+/** Max. number of cells geom can cover, bigger geoms (planes, arena, ...)
+ *  are tested by each query */
+#define GRID_MAX_GEOM_CELLS 64
+/** Max. number of cells query can cover, bigger queries test whole space */
+#define GRID_MAX_QUERY_CELLS 512
+/** Cell coordinates are clamped to [-GRID_COORD_MAX, GRID_COORD_MAX) so
+ *  that three of them fit in 64 bit key */
+#define GRID_COORD_MAX (1L << 20)
+
 namespace sim {
 
 namespace ode {
@@ -93,14 +103,93 @@ void __collision (void *data, dGeomID o1, dGeomID o2)
 }
 
 
+void __rayCollision (void *data, dGeomID o1, dGeomID o2)
+{
+    dContactGeom c;
+    dGeomID ray, geom;
+    RayHit *hit;
+
+    if (dGeomIsSpace(o1) || dGeomIsSpace(o2)){
+        dSpaceCollide2(o1, o2, data, &__rayCollision);
+        return;
+    }
+
+    if (dGeomGetClass(o1) == dRayClass){
+        ray = o1;
+        geom = o2;
+    }else{
+        ray = o2;
+        geom = o1;
+    }
+
+    if (dCollide(ray, geom, 1, &c, sizeof(dContactGeom)) < 1)
+        return;
+
+    hit = (RayHit *)dGeomGetData(ray);
+    if (!hit->hit || c.depth < hit->dist){
+        hit->hit = true;
+        hit->dist = c.depth;
+        hit->point.set(c.pos[0], c.pos[1], c.pos[2]);
+        hit->normal.set(c.normal[0], c.normal[1], c.normal[2]);
+        hit->body = (Body *)dGeomGetData(geom);
+    }
+}
+
+struct __query_ode_t {
+    dGeomID box;
+    World::_query_cb_t cb;
+    void *data;
+};
+
+static int64_t __gridCoord(dReal v, Scalar cell)
+{
+    double c = std::floor(v / cell);
+
+    // also handles infinite bounding boxes (planes) and NaN
+    if (!(c >= -GRID_COORD_MAX))
+        return -GRID_COORD_MAX;
+    if (!(c < GRID_COORD_MAX))
+        return GRID_COORD_MAX - 1;
+    return (int64_t)c;
+}
+
+static uint64_t __gridKey(int64_t x, int64_t y, int64_t z)
+{
+    return ((uint64_t)(x + GRID_COORD_MAX) << 42)
+            | ((uint64_t)(y + GRID_COORD_MAX) << 21)
+            | (uint64_t)(z + GRID_COORD_MAX);
+}
+
+void __queryCollision (void *data, dGeomID o1, dGeomID o2)
+{
+    __query_ode_t *q = (__query_ode_t *)data;
+    dGeomID geom;
+    dReal aabb[6];
+
+    if (dGeomIsSpace(o1) || dGeomIsSpace(o2)){
+        dSpaceCollide2(o1, o2, data, &__queryCollision);
+        return;
+    }
+
+    geom = (o1 == q->box ? o2 : o1);
+    dGeomGetAABB(geom, aabb);
+    q->cb((Body *)dGeomGetData(geom),
+          Vec3(aabb[0], aabb[2], aabb[4]), Vec3(aabb[1], aabb[3], aabb[5]),
+          q->data);
+}
+
+
 World::World()
-    : sim::WorldODE(), _step_type(STEP_TYPE_NORMAL)
+    : sim::WorldODE(), _step_type(STEP_TYPE_NORMAL),
+      _grid_cell(1.), _grid_valid(false)
 {
     dInitODE2(0);
 
     _world = dWorldCreate();
     _space = dHashSpaceCreate(0);
     _coll_contacts = dJointGroupCreate(0);
+    _ray_space = dSimpleSpaceCreate(0);
+    _query_box = dCreateBox(0, 1., 1., 1.);
 
     // set default parameters
     dWorldSetERP(_world, 0.2);
@@ -149,6 +238,10 @@ World::~World()
         dWorldDestroy(_world);
     if (_space)
         dSpaceDestroy(_space);
+    if (_ray_space)
+        dSpaceDestroy(_ray_space);
+    if (_query_box)
+        dGeomDestroy(_query_box);
     if (_coll_contacts)
         dJointGroupDestroy(_coll_contacts);
 
@@ -392,6 +485,8 @@ void World::step(const sim::Time &time, unsigned int substeps)
 
         dJointGroupEmpty(_coll_contacts);
     }
+
+    _gridInvalidate();
 }
 
 bool World::done()
@@ -399,6 +494,178 @@ bool World::done()
     return false;
 }
 
+size_t World::castRays(const Ray *rays, size_t n, RayHit *out)
+{
+    dGeomID ray;
+    Vec3 dir;
+    Scalar len;
+    size_t i, hits = 0;
+
+    // allocate missing ray geoms
+    while (_rays.size() < n){
+        ray = dCreateRay(_ray_space, 1.);
+        dGeomRaySetClosestHit(ray, 1);
+        dGeomDisable(ray);
+        _rays.push_back(ray);
+    }
+
+    for (i = 0; i < n; i++){
+        out[i] = RayHit();
+
+        dir = rays[i].to - rays[i].from;
+        len = dir.length();
+        if (isZero(len))
+            continue;
+        dir /= len;
+
+        ray = _rays[i];
+        dGeomRaySetLength(ray, len);
+        dGeomRaySet(ray, rays[i].from.x(), rays[i].from.y(), rays[i].from.z(),
+                         dir.x(), dir.y(), dir.z());
+        dGeomSetData(ray, &out[i]);
+        dGeomEnable(ray);
+    }
+
+    dSpaceCollide2((dGeomID)_ray_space, (dGeomID)_space, 0, &__rayCollision);
+
+    for (i = 0; i < n; i++){
+        dGeomDisable(_rays[i]);
+        if (out[i].hit)
+            ++hits;
+    }
+
+    return hits;
+}
+
+void World::_queryAABB(const Vec3 &min, const Vec3 &max, _query_cb_t cb, void *data)
+{
+    __query_ode_t q;
+    Vec3 center = (min + max) * 0.5;
+    Vec3 dim = max - min;
+    dReal box[6] = { min.x(), max.x(), min.y(), max.y(), min.z(), max.z() };
+    dReal aabb[6];
+    int64_t from[3], to[3], x, y, z;
+    uint64_t key;
+    std::vector<size_t> found;
+    std::vector<size_t>::iterator it, it_end;
+    std::vector<std::pair<uint64_t, size_t> >::const_iterator cell;
+    dGeomID geom;
+
+    dGeomBoxSetLengths(_query_box, dim.x(), dim.y(), dim.z());
+    dGeomSetPosition(_query_box, center.x(), center.y(), center.z());
+
+    q.box = _query_box;
+    q.cb = cb;
+    q.data = data;
+
+    if (!_grid_valid)
+        _gridBuild();
+
+    if (_gridRange(box, from, to) > GRID_MAX_QUERY_CELLS){
+        dSpaceCollide2(_query_box, (dGeomID)_space, &q, &__queryCollision);
+        return;
+    }
+
+    found = _grid_big;
+    for (x = from[0]; x <= to[0]; x++){
+        for (y = from[1]; y <= to[1]; y++){
+            for (z = from[2]; z <= to[2]; z++){
+                key = __gridKey(x, y, z);
+                cell = std::lower_bound(_grid.begin(), _grid.end(),
+                                        std::make_pair(key, (size_t)0));
+                for (; cell != _grid.end() && cell->first == key; ++cell)
+                    found.push_back(cell->second);
+            }
+        }
+    }
+
+    // geom covering more cells is found more times, sorting by index
+    // also keeps order of geoms in space
+    std::sort(found.begin(), found.end());
+    it_end = std::unique(found.begin(), found.end());
+    for (it = found.begin(); it != it_end; ++it){
+        geom = _grid_geoms[*it];
+
+        dGeomGetAABB(geom, aabb);
+        if (aabb[0] > box[1] || aabb[1] < box[0]
+                || aabb[2] > box[3] || aabb[3] < box[2]
+                || aabb[4] > box[5] || aabb[5] < box[4])
+            continue;
+
+        __queryCollision(&q, _query_box, geom);
+    }
+}
+
+void World::_gridBuild()
+{
+    int i, len;
+    size_t j;
+    dGeomID geom;
+    dReal aabb[6];
+    Scalar size, sum = 0.;
+    size_t num = 0;
+    int64_t from[3], to[3], x, y, z;
+
+    _grid_geoms.clear();
+    _grid.clear();
+    _grid_big.clear();
+
+    // make sure bounding boxes are up to date
+    dSpaceClean(_space);
+
+    len = dSpaceGetNumGeoms(_space);
+    for (i = 0; i < len; i++){
+        geom = dSpaceGetGeom(_space, i);
+        if (!dGeomIsEnabled(geom))
+            continue;
+        _grid_geoms.push_back(geom);
+
+        dGeomGetAABB(geom, aabb);
+        size = std::max(aabb[1] - aabb[0],
+                        std::max(aabb[3] - aabb[2], aabb[5] - aabb[4]));
+        if (size < dInfinity){
+            sum += size;
+            ++num;
+        }
+    }
+
+    _grid_cell = 1.;
+    if (num > 0 && sum > 0.)
+        _grid_cell = sum / num;
+
+    for (j = 0; j < _grid_geoms.size(); j++){
+        dGeomGetAABB(_grid_geoms[j], aabb);
+        if (_gridRange(aabb, from, to) > GRID_MAX_GEOM_CELLS){
+            _grid_big.push_back(j);
+            continue;
+        }
+
+        for (x = from[0]; x <= to[0]; x++){
+            for (y = from[1]; y <= to[1]; y++){
+                for (z = from[2]; z <= to[2]; z++){
+                    _grid.push_back(std::make_pair(__gridKey(x, y, z), j));
+                }
+            }
+        }
+    }
+    std::sort(_grid.begin(), _grid.end());
+
+    _grid_valid = true;
+}
+
+size_t World::_gridRange(const dReal *aabb, int64_t *from, int64_t *to) const
+{
+    size_t cells = 1;
+
+    for (size_t i = 0; i < 3; i++){
+        from[i] = __gridCoord(aabb[2 * i], _grid_cell);
+        to[i]   = __gridCoord(aabb[2 * i + 1], _grid_cell);
+        cells  *= (size_t)(to[i] - from[i] + 1);
+    }
+
+    return cells;
+}
+
 
 
 sim::Body *World::createBodyCube(Scalar width, Scalar mass, VisBody *vis)
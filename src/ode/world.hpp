@@ -22,6 +22,8 @@
 #ifndef _SIM_ODE_WORLD_HPP_
 #define _SIM_ODE_WORLD_HPP_
 
+#include <vector>
+#include <stdint.h>
 #include <ode/ode.h>
 
 #include "sim/visworld.hpp"
@@ -34,6 +36,8 @@ namespace sim {
 namespace ode {
 
 void __collision (void *data, dGeomID o1, dGeomID o2);
+void __rayCollision (void *data, dGeomID o1, dGeomID o2);
+void __queryCollision (void *data, dGeomID o1, dGeomID o2);
 
 /**
  * Physical representation world.
@@ -56,8 +60,21 @@ class World : public sim::WorldODE {
     _bodies_t _bodies;
     _joints_t _joints;
 
+    dSpaceID _ray_space; //!< Space holding ray geoms used by castRays()
+    std::vector<dGeomID> _rays; //!< Preallocated ray geoms
+    dGeomID _query_box; //!< Geom used for spatial queries
+
+    std::vector<dGeomID> _grid_geoms; //!< Geoms of _space in grid
+    std::vector<std::pair<uint64_t, size_t> > _grid; /*!< (cell, index to
+                                                          _grid_geoms)
+                                                          sorted by cell */
+    std::vector<size_t> _grid_big; //!< Geoms too big to be put in grid
+    Scalar _grid_cell; //!< Edge of grid's cell
+    bool _grid_valid; //!< False if grid must be rebuilt
+
 
     friend void __collision(void *, dGeomID, dGeomID);
+    friend class Body;
 
   public:
     World();
@@ -248,10 +265,44 @@ class World : public sim::WorldODE {
     sim::Joint *createJointHinge2(sim::Body *A, sim::Body *oB, const Vec3 &anchor,
                                   const Vec3 &axis1, const Vec3 &axis2);
 
+    /**
+     * Rays are represented by ODE's ray geoms which are collided with
+     * world's space using dSpaceCollide2().
+     */
+    size_t castRays(const Ray *rays, size_t n, RayHit *out);
+
   protected:
     void _contactEnableMode(int mode);
     void _contactDisableMode(int mode);
     bool _contactEnabledMode(int mode) const;
+
+    /**
+     * Bounding boxes of geoms are looked up in uniform grid, so the query
+     * costs only number of geoms near the box. The grid is built on first
+     * query after geoms moved (step, (de)activation of body). Queries
+     * spanning too many cells fall back to collision of box geom with
+     * whole space using dSpaceCollide2().
+     */
+    void _queryAABB(const Vec3 &min, const Vec3 &max, _query_cb_t cb, void *data);
+
+    /**
+     * Marks grid used by _queryAABB() invalid.
+     */
+    void _gridInvalidate() { _grid_valid = false; }
+
+    /**
+     * Builds grid from bounding boxes of all enabled geoms in _space.
+     * Edge of cell is average size of the boxes.
+     */
+    void _gridBuild();
+
+    /**
+     * Computes range of cells covering given box.
+     * Returns number of the cells.
+     */
+    size_t _gridRange(const dReal *aabb, int64_t *from, int64_t *to) const;
+
+    friend void __queryCollision(void *, dGeomID, dGeomID);
 };
 
 } /* namespace ode */
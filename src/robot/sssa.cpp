@@ -240,7 +240,7 @@ void SSSA::ballSetup(Vec3 *pos, Vec3 *dir, Vec3 *up) const
 int SSSA::canConnectTo(const sim::robot::SSSA &robot) const
 {
     // maximal distance between ball and socket
-    const Scalar max_dist = 0.01;
+    const Scalar max_dist = SIM_ROBOT_SSSA_CONNECT_DIST;
     // maximal angle (about x, y and z axis) ball and socket can differ
     const Scalar max_angle = 0.1;
     Vec3 ball_pos, ball_dir, ball_up;
@@ -25,6 +25,9 @@
 
 #include <sim/world.hpp>
 
+#define SIM_ROBOT_SSSA_CONNECT_DIST 0.01 /*!< Max. distance between ball and
+                                              socket that can be connected */
+
 namespace sim {
 
 namespace robot {
@@ -19,25 +19,98 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <stdio.h>
-#include <osgDB/WriteFile>
+#include <string.h>
 #include <osg/ShapeDrawable>
+#include <osg/Geometry>
+#include <osg/Program>
 
 #include "camera.hpp"
+#include "readback.hpp"
+#include "cameraatlas.hpp"
 #include <sim/msg.hpp>
 
 
 namespace sim {
 namespace sensor {
 
+/**
+ * Converts color to luminance.
+ */
+static const char *gray_frag =
+    "uniform sampler2D tex;\n"
+    "void main()\n"
+    "{\n"
+    "    vec3 c = texture2D(tex, gl_TexCoord[0].st).rgb;\n"
+    "    gl_FragColor = vec4(vec3(dot(c, vec3(0.299, 0.587, 0.114))), 1.);\n"
+    "}\n";
+
+/**
+ * Returns GL pixel format and number of bytes per pixel of given format.
+ */
+static void formatGL(Camera::Format format, GLenum *gl, int *components)
+{
+    switch (format){
+        case Camera::FORMAT_RGB8:
+            *gl = GL_RGB;
+            *components = 3;
+            break;
+        case Camera::FORMAT_BGR8:
+            *gl = GL_BGR;
+            *components = 3;
+            break;
+        case Camera::FORMAT_GRAY8:
+            // post pass stores luminance in all channels and L = R when
+            // texture is read
+            *gl = GL_LUMINANCE;
+            *components = 1;
+            break;
+        default:
+            *gl = GL_RGBA;
+            *components = 4;
+    }
+}
+
+/**
+ * Hands images read from camera's texture to camera.
+ */
+class CameraReadback : public TextureReadback {
+    Camera *_cam;
+
+  public:
+    CameraReadback(Camera *cam)
+        : TextureReadback(0, 0, 0), _cam(cam)
+        {}
+
+  protected:
+    void _ready(const unsigned char *data) const
+        { _cam->_imageReady(data); }
+};
+
+/**
+ * Counts images read synchronously by OSG.
+ */
+class CameraImageSeq : public osg::Camera::DrawCallback {
+    Camera *_cam;
+
+  public:
+    CameraImageSeq(Camera *cam) : _cam(cam) {}
+
+    void operator()(osg::RenderInfo &info) const
+        { ++_cam->_image_seq; }
+};
+
+
 Camera::Camera()
     : sim::Component(),
-      _cam(0), _image(0), _vis(0), _vis_enabled(false),
+      _cam(0), _image(0), _async(true), _image_seq(0), _atlas(0),
+      _format(FORMAT_RGBA8), _decimate(1),
+      _vis(0), _vis_enabled(false),
       _eye(0., 0., 0.), _at(0., 0., 0.), _zaxis(0., 0., 1.),
       _bgcolor(0.1, 0.1, 0.3, 1.),
       _width(100), _height(100),
+      _fovy(75.), _near(0.01), _far(10.),
       _body(0), _body_offset_pos(0., 0., 0.), _body_offset_rot(0., 0., 0., 1.),
-      _dump_prefix(0)
+      _dump_prefix(0), _dump_raw(false), _dumper(0), _dumped_seq(0)
 
 {
     // create visual representation
@@ -47,6 +120,8 @@ Camera::Camera()
 
 Camera::~Camera()
 {
+    if (_dumper)
+        delete _dumper;
 }
 
 void Camera::init(sim::Sim *sim)
@@ -54,15 +129,31 @@ void Camera::init(sim::Sim *sim)
     _sim = sim;
 
 
-    if (_dump_prefix)
+    if (_dump_prefix){
+        _dumper = new ImageDumper(_dump_prefix,
+                _dump_raw ? ImageDumper::MODE_RAW : ImageDumper::MODE_FILES);
         _sim->regPreStep(this);
+    }
 
     _sim->regPostStep(this);
 
+    if ((!_async || _atlas) && (_format != FORMAT_RGBA8 || _decimate > 1)){
+        ERR("Pixel format and decimation can be used only with"
+            " asynchronous readback and without atlas.");
+        _format = FORMAT_RGBA8;
+        _decimate = 1;
+    }
+
     _createCamera();
-    _sim->visWorld()->addCam(_cam);
+    if (_atlas){
+        _atlas->addCamera(this);
+    }else{
+        _sim->visWorld()->addCam(_cam);
+    }
+    if (_post.valid())
+        _sim->visWorld()->addCam(_post, false);
 
-    if (_view_enabled){
+    if (_view_enabled && !_sim->visWorld()->headless()){
         _createView();
         _sim->visWorld()->addView(_view);
     }
@@ -75,24 +166,31 @@ void Camera::init(sim::Sim *sim)
 
 void Camera::finish()
 {
+    // camera removed from atlas is given its own render pass
+    if (_atlas)
+        _atlas->rmCamera(this);
     _sim->visWorld()->rmCam(_cam);
+    if (_post.valid())
+        _sim->visWorld()->rmCam(_post);
 
     if (_view.valid())
         _sim->visWorld()->rmView(_view);
 
     if (_vis_enabled && _vis)
         _sim->visWorld()->rmBody(_vis);
+
+    // write all queued images
+    if (_dumper){
+        delete _dumper;
+        _dumper = 0;
+    }
 }
 
 void Camera::cbPreStep()
 {
-    static size_t counter = 0;
-    static char fn[100];
-
-    if (_dump_prefix && _image->valid()){
-        sprintf(fn, "%s%06d.png", _dump_prefix, (int)counter);
-        osgDB::writeImageFile(*_image, fn);
-        counter++;
+    if (_dumper && _image_seq != _dumped_seq){
+        _dumper->dump(_image.get());
+        _dumped_seq = _image_seq;
     }
 }
 
@@ -112,23 +210,68 @@ void Camera::_createCamera()
 {
     Scalar aspect = (Scalar)_width / (Scalar)_height;
 
-    // delete camera if already created
-    if (_cam)
-        _cam->unref();
-
-    // set up camera
+    // set up camera (previous one, if any, is released by ref_ptr)
     _cam = new osg::Camera;
     _cam->setClearColor(_bgcolor);
-    _cam->setProjectionMatrixAsPerspective(75, aspect, 0.01, 10.);
+    _cam->setProjectionMatrixAsPerspective(_fovy, aspect, _near, _far);
     _cam->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
     _cam->setViewport(0, 0, _width, _height);
-    _cam->setRenderOrder(osg::Camera::PRE_RENDER);
 
-    // attach image to camera - each frame will be stored in _image
+    // image is allocated when first frame is read
     _image = new osg::Image;
-    //_image->allocateImage(width, height, 1, GL_RGBA, GL_FLOAT);
-    _cam->attach(osg::Camera::COLOR_BUFFER, _image);
 
+    // camera in atlas is only viewport of atlas's render pass, atlas
+    // also takes care of image
+    if (_atlas){
+        _cam->setRenderOrder(osg::Camera::NESTED_RENDER);
+        return;
+    }
+
+    _cam->setRenderOrder(osg::Camera::PRE_RENDER);
+
+    // render into FBO so that camera doesn't depend on size (or
+    // existence) of window
+    _cam->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+
+    if (_async){
+        CameraReadback *readback;
+        GLenum format;
+        int components;
+
+        // render into texture, its content is read into _image by
+        // CameraReadback with one frame latency
+        _tex = new osg::Texture2D;
+        _tex->setTextureSize(_width, _height);
+        _tex->setInternalFormat(GL_RGBA);
+        _tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+
+        // mipmaps are used for downsampling
+        if (_decimate > 1){
+            _tex->setFilter(osg::Texture::MIN_FILTER,
+                            osg::Texture::LINEAR_MIPMAP_LINEAR);
+        }else{
+            _tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+        }
+        _cam->attach(osg::Camera::COLOR_BUFFER, _tex.get(), 0, 0,
+                     _decimate > 1);
+
+        readback = new CameraReadback(this);
+        formatGL(_format, &format, &components);
+        readback->setFormat(format, GL_UNSIGNED_BYTE, components);
+
+        if (_format == FORMAT_GRAY8 || _decimate > 1){
+            _createPostPass();
+            readback->setTexture(_post_tex.get(), imageWidth(), imageHeight());
+            _post->setFinalDrawCallback(readback);
+        }else{
+            readback->setTexture(_tex.get(), _width, _height);
+            _cam->setFinalDrawCallback(readback);
+        }
+    }else{
+        // attach image to camera - each frame will be stored in _image
+        _cam->attach(osg::Camera::COLOR_BUFFER, _image);
+        _cam->setFinalDrawCallback(new CameraImageSeq(this));
+    }
 }
 
 void Camera::_createView()
@@ -153,7 +296,7 @@ void Camera::_createView()
     // set up camera
     osg::Camera *cam = new osg::Camera;
     cam->setClearColor(_bgcolor);
-    cam->setProjectionMatrixAsPerspective(75, aspect, 0.01, 10.);
+    cam->setProjectionMatrixAsPerspective(_fovy, aspect, _near, _far);
     cam->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
     cam->setViewport(0, 0, _width, _height);
     cam->setGraphicsContext(gc.get());
@@ -165,6 +308,67 @@ void Camera::_createView()
     _view->setCamera(cam);
 }
 
+void Camera::_createPostPass()
+{
+    osg::Geometry *quad;
+    osg::Geode *geode;
+    osg::StateSet *state;
+    osg::Program *prog;
+
+    _post_tex = new osg::Texture2D;
+    _post_tex->setTextureSize(imageWidth(), imageHeight());
+    _post_tex->setInternalFormat(GL_RGBA);
+    _post_tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+    _post_tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+
+    // quad covering whole viewport textured by camera's texture - it is
+    // minified (i.e., filtered using mipmaps) if image is decimated
+    quad = osg::createTexturedQuadGeometry(osg::Vec3(0., 0., 0.),
+                                           osg::Vec3(1., 0., 0.),
+                                           osg::Vec3(0., 1., 0.));
+    geode = new osg::Geode;
+    geode->addDrawable(quad);
+
+    state = geode->getOrCreateStateSet();
+    state->setTextureAttributeAndModes(0, _tex.get(), osg::StateAttribute::ON);
+    state->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+    state->setMode(GL_DEPTH_TEST, osg::StateAttribute::OFF);
+
+    if (_format == FORMAT_GRAY8){
+        prog = new osg::Program;
+        prog->addShader(new osg::Shader(osg::Shader::FRAGMENT, gray_frag));
+        state->setAttributeAndModes(prog, osg::StateAttribute::ON);
+        state->addUniform(new osg::Uniform("tex", 0));
+    }
+
+    _post = new osg::Camera;
+    _post->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
+    _post->setProjectionMatrixAsOrtho2D(0., 1., 0., 1.);
+    _post->setViewMatrix(osg::Matrix::identity());
+    _post->setViewport(0, 0, imageWidth(), imageHeight());
+    _post->setRenderOrder(osg::Camera::PRE_RENDER, 1);
+    _post->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+    _post->attach(osg::Camera::COLOR_BUFFER, _post_tex.get());
+    _post->addChild(geode);
+}
+
+void Camera::_imageReady(const void *data)
+{
+    GLenum format;
+    int components;
+
+    if (!_image->data()){
+        formatGL(_format, &format, &components);
+        _image->allocateImage(imageWidth(), imageHeight(), 1,
+                              format, GL_UNSIGNED_BYTE);
+    }
+
+    memcpy(_image->data(), data, _image->getTotalSizeInBytes());
+    _image->dirty();
+
+    ++_image_seq;
+}
+
 void Camera::_updatePosition()
 {
     if (_body){
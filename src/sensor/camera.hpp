@@ -22,14 +22,20 @@
 #ifndef _SIM_SENSOR_CAMERA_HPP_
 #define _SIM_SENSOR_CAMERA_HPP_
 
+#include <osg/Texture2D>
 #include <sim/sim.hpp>
 #include <sim/body.hpp>
 #include <sim/component.hpp>
+#include <sim/sensor/imagedumper.hpp>
 
 namespace sim {
 
 namespace sensor {
 
+class CameraReadback;
+class CameraImageSeq;
+class CameraAtlas;
+
 /**
  * Camera sensor that can be static or attached to any Body.
  * If you want to create static Camera simply use setLookAt() method to set
@@ -41,11 +47,34 @@ namespace sensor {
  * defaults.
  */
 class Camera : public sim::Component {
+    friend class CameraReadback;
+    friend class CameraImageSeq;
+    friend class CameraAtlas;
+
+  public:
+    /**
+     * Pixel formats of image().
+     */
+    enum Format {
+        FORMAT_RGBA8 = 0, /*!< 4 bytes per pixel (default) */
+        FORMAT_RGB8,      /*!< 3 bytes per pixel */
+        FORMAT_BGR8,      /*!< 3 bytes per pixel in order used by rsim */
+        FORMAT_GRAY8      /*!< 1 byte per pixel (luminance) */
+    };
+
   protected:
     Sim *_sim;
 
     osg::ref_ptr<osg::Camera> _cam; /*!< Camera node */
     osg::ref_ptr<osg::Image> _image; /*!< Image where is stored what camera took */
+    osg::ref_ptr<osg::Texture2D> _tex; /*!< Texture camera renders into */
+    bool _async; /*!< True if image is read asynchronously (default true) */
+    unsigned long _image_seq; /*!< Sequence number of _image */
+    CameraAtlas *_atlas; /*!< Atlas camera is rendered into or 0 */
+    Format _format; /*!< Pixel format of _image */
+    int _decimate; /*!< Image is _decimate times smaller than viewport */
+    osg::ref_ptr<osg::Camera> _post; /*!< Conversion/downsampling pass */
+    osg::ref_ptr<osg::Texture2D> _post_tex; /*!< Output of _post */
     VisBody *_vis; /*!< Visual representation (for debugging). */
     bool _vis_enabled; /*!< Is visual representation enabled? (default false) */
 
@@ -54,6 +83,8 @@ class Camera : public sim::Component {
     Vec3 _zaxis; /*! Where is zaxis of camera */
     osg::Vec4 _bgcolor; /*!< Background color (default blue) */
     int _width, _height; /*!< Width and height of taken pictures (default 100x100) */
+    Scalar _fovy; /*!< Vertical field of view in degrees (default 75) */
+    Scalar _near, _far; /*!< Near and far clipping planes (default 0.01, 10) */
 
     const sim::Body *_body; /*!< Body camera is attached to. */
     Vec3 _body_offset_pos; /*!< Position offset of camera from body. */
@@ -62,6 +93,9 @@ class Camera : public sim::Component {
     const char *_dump_prefix; /*!< Prefix of files where camera will dump
                                    all images. If prefix is zero dumping is
                                    disabled */
+    bool _dump_raw; /*!< Dump into raw sequence file instead of .png files */
+    ImageDumper *_dumper; /*!< Writes images in background */
+    unsigned long _dumped_seq; /*!< Sequence number of last dumped image */
 
     osg::ref_ptr<osgViewer::View> _view;
     bool _view_enabled; /*!< By default view is disabled */
@@ -74,6 +108,12 @@ class Camera : public sim::Component {
     const osg::Camera *cam() const { return _cam.get(); }
     osg::Image *image() { return _image.get(); }
     const osg::Image *image() const { return _image.get(); }
+
+    /**
+     * Returns sequence number of image. It is incremented each time new
+     * image is stored in image(), zero means no image was taken yet.
+     */
+    unsigned long imageSeq() const { return _image_seq; }
     VisBody *vis() { return _vis; }
     const VisBody *visBody() const { return _vis; }
     bool visBodyEnabled() const { return _vis_enabled; }
@@ -112,11 +152,71 @@ class Camera : public sim::Component {
     void setWidthHeight(int w, int h) { _width = w; _height = h; }
 
     /**
-     * Enables dumping images to .png files.
+     * Sets vertical field of view (in degrees) and near and far clipping
+     * planes of perspective projection.
      */
-    void enableDump(const char *prefix = "") { _dump_prefix = prefix; }
+    void setPerspective(Scalar fovy, Scalar znear, Scalar zfar)
+        { _fovy = fovy; _near = znear; _far = zfar; }
+    Scalar fovy() const { return _fovy; }
+    Scalar nearPlane() const { return _near; }
+    Scalar farPlane() const { return _far; }
+
+    /**
+     * Enables dumping images to .png files (or into one raw sequence file
+     * if raw is true, see ImageDumper). Images are written in background
+     * and each new image is dumped once.
+     * Must be called before init().
+     */
+    void enableDump(const char *prefix = "", bool raw = false)
+        { _dump_prefix = prefix; _dump_raw = raw; }
     void disableDump() { _dump_prefix = 0; }
 
+    /**
+     * Returns dumper of images (with counters of written and dropped
+     * images) or 0 if dumping is disabled.
+     */
+    const ImageDumper *dumper() const { return _dumper; }
+
+    /**
+     * Enables/disables asynchronous read of images.
+     * If enabled (default) camera renders into texture that is read into
+     * pixel buffer objects in background and image of frame N is
+     * available while frame N+1 is rendered. If disabled, image is read
+     * synchronously right after camera is rendered.
+     * Must be set before init().
+     */
+    void setAsyncReadback(bool yes = true) { _async = yes; }
+    bool asyncReadback() const { return _async; }
+
+    /**
+     * Sets pixel format of image(). Conversion is done on GPU.
+     * Formats other than FORMAT_RGBA8 are available only with
+     * asynchronous readback and without atlas.
+     * Must be set before init().
+     */
+    void setFormat(Format format) { _format = format; }
+    Format format() const { return _format; }
+
+    /**
+     * Image will be downsampled on GPU to (width / d) x (height / d).
+     * Same restrictions as for setFormat() apply.
+     */
+    void setDecimation(int d) { _decimate = (d < 1 ? 1 : d); }
+    int decimation() const { return _decimate; }
+
+    /**
+     * Size of image().
+     */
+    int imageWidth() const { return _width / _decimate; }
+    int imageHeight() const { return _height / _decimate; }
+
+    /**
+     * Camera will be rendered as part of given atlas (see CameraAtlas).
+     * Must be set before init().
+     */
+    void setAtlas(CameraAtlas *atlas) { _atlas = atlas; }
+    CameraAtlas *atlas() { return _atlas; }
+
     /**
      * Enables/Disables view window.
      */
@@ -155,7 +255,7 @@ class Camera : public sim::Component {
     /**
      * Creates camera according to previously set parameters.
      */
-    void _createCamera();
+    virtual void _createCamera();
 
     /**
      * Creates view.
@@ -168,6 +268,17 @@ class Camera : public sim::Component {
      * body and _eye, _at, _zaxis is set properly.
      */
     void _updatePosition();
+
+    /**
+     * Creates pass converting/downsampling camera's texture into
+     * _post_tex.
+     */
+    void _createPostPass();
+
+    /**
+     * Stores new image data (in _format) read from GPU.
+     */
+    void _imageReady(const void *data);
 };
 
 } /* namespace sensor */
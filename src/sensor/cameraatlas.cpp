@@ -0,0 +1,238 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <osg/Version>
+
+#include "cameraatlas.hpp"
+#include <sim/msg.hpp>
+
+namespace sim {
+namespace sensor {
+
+/**
+ * Hands content of atlas read from GPU to atlas.
+ */
+class CameraAtlasReadback : public TextureReadback {
+    CameraAtlas *_atlas;
+
+  public:
+    CameraAtlasReadback(CameraAtlas *atlas)
+        : TextureReadback(0, 0, 0), _atlas(atlas)
+        {}
+
+  protected:
+    void _ready(const unsigned char *data) const
+        { _atlas->_imageReady(data); }
+};
+
+
+CameraAtlas::CameraAtlas(int width)
+    : sim::Component(),
+      _sim(0),
+      _width(width), _height(0),
+      _row_x(0), _row_y(0), _row_h(0),
+      _bgcolor(0.1, 0.1, 0.3, 1.),
+      _image_seq(0)
+{
+    _cam = new osg::Camera;
+    _cam->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
+    _cam->setRenderOrder(osg::Camera::PRE_RENDER);
+    _cam->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+
+    _image = new osg::Image;
+
+    _readback = new CameraAtlasReadback(this);
+    _cam->setFinalDrawCallback(_readback.get());
+}
+
+CameraAtlas::~CameraAtlas()
+{
+}
+
+void CameraAtlas::init(sim::Sim *sim)
+{
+    _sim = sim;
+
+    _cam->setClearColor(_bgcolor);
+
+    // atlas is rendered only if it has some cameras (see _createTexture())
+    if (_tex.valid())
+        _sim->visWorld()->addCam(_cam.get(), false);
+}
+
+void CameraAtlas::finish()
+{
+    _sim->visWorld()->rmCam(_cam.get());
+}
+
+void CameraAtlas::addCamera(Camera *cam)
+{
+    cam_t c;
+    std::list<slot_t>::iterator slot;
+
+    if (cam->_width > _width){
+        ERR("Camera is wider (" << cam->_width << ") than atlas ("
+            << _width << ").");
+        return;
+    }
+
+    c.cam = cam;
+    c.bound = false;
+
+    // reuse slot released by some removed camera if camera fits into it
+    for (slot = _free.begin(); slot != _free.end(); ++slot){
+        if (slot->w >= cam->_width && slot->h >= cam->_height)
+            break;
+    }
+
+    if (slot != _free.end()){
+        c.x = slot->x;
+        c.y = slot->y;
+        _free.erase(slot);
+    }else{
+        // start new row if camera doesn't fit into current one
+        if (_row_x + cam->_width > _width){
+            _row_y += _row_h;
+            _row_x = 0;
+            _row_h = 0;
+        }
+
+        c.x = _row_x;
+        c.y = _row_y;
+
+        _row_x += cam->_width;
+        _row_h = std::max(_row_h, cam->_height);
+    }
+    _cams.push_back(c);
+
+    cam->_cam->setViewport(c.x, c.y, cam->_width, cam->_height);
+    cam->_cam->addChild(cam->_sim->visWorld()->sceneRoot());
+    _cam->addChild(cam->_cam.get());
+
+    if (_row_y + _row_h > _height){
+        _height = _row_y + _row_h;
+        _createTexture();
+    }
+}
+
+void CameraAtlas::rmCamera(Camera *cam)
+{
+    std::list<cam_t>::iterator it;
+    slot_t slot;
+
+    for (it = _cams.begin(); it != _cams.end(); ++it){
+        if (it->cam == cam)
+            break;
+    }
+    if (it == _cams.end())
+        return;
+
+    _cam->removeChild(cam->_cam.get());
+    cam->_cam->removeChild(cam->_sim->visWorld()->sceneRoot());
+
+    slot.x = it->x;
+    slot.y = it->y;
+    slot.w = cam->_width;
+    slot.h = cam->_height;
+    _free.push_back(slot);
+    _cams.erase(it);
+
+    // camera gets its own camera node with own viewport, render target
+    // and image (current one may refer into atlas memory)
+    cam->_atlas = 0;
+    cam->_createCamera();
+    cam->_sim->visWorld()->addCam(cam->_cam);
+}
+
+void CameraAtlas::_createTexture()
+{
+    _tex = new osg::Texture2D;
+    _tex->setTextureSize(_width, _height);
+    _tex->setInternalFormat(GL_RGBA);
+    _tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+    _tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+
+    _cam->setViewport(0, 0, _width, _height);
+    _cam->detach(osg::Camera::COLOR_BUFFER);
+    _cam->attach(osg::Camera::COLOR_BUFFER, _tex.get());
+#if OSG_MIN_VERSION_REQUIRED(3, 2, 0)
+    _cam->dirtyAttachmentMap();
+#endif
+
+    _readback->setTexture(_tex.get(), _width, _height);
+
+    if (_sim)
+        _sim->visWorld()->addCam(_cam.get(), false);
+
+    DBG("Camera atlas: " << _width << "x" << _height
+        << ", " << _cams.size() << " cameras");
+}
+
+void CameraAtlas::_imageReady(const unsigned char *data)
+{
+    osg::Image *img;
+
+    if (!_image->data() || _image->t() != _height){
+        _image->allocateImage(_width, _height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+
+        // cameras must be pointed to new memory
+        for_each(std::list<cam_t>::iterator, _cams){
+            it->bound = false;
+        }
+    }
+
+    memcpy(_image->data(), data, _image->getTotalSizeInBytes());
+    ++_image_seq;
+
+    for_each(std::list<cam_t>::iterator, _cams){
+        img = it->cam->_image.get();
+
+#if OSG_MIN_VERSION_REQUIRED(3, 2, 0)
+        // image of camera refers directly into atlas
+        if (!it->bound){
+            img->setImage(it->cam->_width, it->cam->_height, 1,
+                          GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE,
+                          _image->data(it->x, it->y),
+                          osg::Image::NO_DELETE, 1, _width);
+            it->bound = true;
+        }
+#else
+        // no support for row length - copy rows of camera
+        if (!img->data()){
+            img->allocateImage(it->cam->_width, it->cam->_height, 1,
+                               GL_RGBA, GL_UNSIGNED_BYTE);
+        }
+        for (int r = 0; r < it->cam->_height; r++){
+            memcpy(img->data(0, r), _image->data(it->x, it->y + r),
+                   it->cam->_width * 4);
+        }
+#endif
+
+        img->dirty();
+        ++it->cam->_image_seq;
+    }
+}
+
+} /* namespace sensor */
+
+} /* namespace sim */
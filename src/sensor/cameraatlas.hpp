@@ -0,0 +1,123 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_SENSOR_CAMERAATLAS_HPP_
+#define _SIM_SENSOR_CAMERAATLAS_HPP_
+
+#include <list>
+#include <osg/Texture2D>
+#include <sim/sim.hpp>
+#include <sim/sensor/camera.hpp>
+#include <sim/sensor/readback.hpp>
+
+namespace sim {
+
+namespace sensor {
+
+/**
+ * Renders many small cameras as viewports of one shared texture.
+ *
+ * All registered cameras are rendered in one render pass into one texture
+ * (atlas) that is read back from GPU at once (asynchronously, see
+ * TextureReadback). Image of each camera (Camera::image()) then refers
+ * to its part of atlas, no pixels are copied.
+ * Camera is placed into atlas by Camera::setAtlas(), cameras are packed
+ * in rows from bottom to top, height of atlas grows as needed.
+ *
+ * All cameras are cleared by atlas's background color, their own
+ * background color is ignored. Cameras should be added before simulation
+ * starts (i.e., in init() of components).
+ */
+class CameraAtlas : public sim::Component {
+    friend class CameraAtlasReadback;
+
+  protected:
+    struct cam_t {
+        Camera *cam;
+        int x, y; /*!< Position in atlas */
+        bool bound; /*!< True if image of camera refers into atlas */
+    };
+
+    struct slot_t {
+        int x, y, w, h; /*!< Free rectangle of atlas */
+    };
+
+    sim::Sim *_sim;
+
+    int _width, _height; /*!< Size of atlas */
+    int _row_x, _row_y, _row_h; /*!< Position and height of current row */
+    osg::Vec4 _bgcolor;
+
+    osg::ref_ptr<osg::Camera> _cam; /*!< Camera rendering whole atlas */
+    osg::ref_ptr<osg::Texture2D> _tex; /*!< Atlas texture */
+    osg::ref_ptr<osg::Image> _image; /*!< Content of atlas */
+    osg::ref_ptr<TextureReadback> _readback;
+    unsigned long _image_seq;
+
+    std::list<cam_t> _cams;
+    std::list<slot_t> _free; /*!< Slots released by rmCamera() */
+
+  public:
+    CameraAtlas(int width = 1024);
+    ~CameraAtlas();
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    size_t numCameras() const { return _cams.size(); }
+
+    const osg::Image *image() const { return _image.get(); }
+    unsigned long imageSeq() const { return _image_seq; }
+
+    void setBgColor(const osg::Vec4 &c) { _bgcolor = c; }
+    const osg::Vec4 &bgColor() const { return _bgcolor; }
+
+    void init(sim::Sim *sim);
+    void finish();
+
+    /**
+     * Places camera into atlas. Called from Camera::init().
+     */
+    void addCamera(Camera *cam);
+
+    /**
+     * Removes camera from atlas and releases its slot for later cameras.
+     * Camera gets back its own image and render target, i.e., if
+     * simulation is running, it is rendered on its own from now on.
+     */
+    void rmCamera(Camera *cam);
+
+  protected:
+    /**
+     * (Re)creates atlas texture according to current size of atlas.
+     */
+    void _createTexture();
+
+    /**
+     * Stores content of atlas read from GPU and updates images of cameras.
+     */
+    void _imageReady(const unsigned char *data);
+};
+
+} /* namespace sensor */
+
+} /* namespace sim */
+
+#endif /* _SIM_SENSOR_CAMERAATLAS_HPP_ */
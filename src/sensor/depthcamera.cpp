@@ -0,0 +1,161 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+
+#include "depthcamera.hpp"
+#include "readback.hpp"
+#include <sim/msg.hpp>
+
+namespace sim {
+namespace sensor {
+
+/**
+ * Reads depth buffer of camera. Pose of camera is remembered for each
+ * frame because data arrive one frame later.
+ */
+class DepthCameraReadback : public TextureReadback {
+    DepthCamera *_cam;
+    mutable Vec3 _eye[2], _at[2], _zaxis[2]; /*!< Pose for each PBO */
+
+  public:
+    DepthCameraReadback(DepthCamera *cam)
+        : TextureReadback(cam->_depth_tex.get(), cam->_width, cam->_height),
+          _cam(cam)
+    {
+        setFormat(GL_DEPTH_COMPONENT, GL_FLOAT, sizeof(float));
+    }
+
+    void operator()(osg::RenderInfo &info) const
+    {
+        _eye[_idx] = _cam->_eye;
+        _at[_idx] = _cam->_at;
+        _zaxis[_idx] = _cam->_zaxis;
+
+        TextureReadback::operator()(info);
+    }
+
+  protected:
+    void _ready(const unsigned char *data) const
+    {
+        // data belong to previous frame
+        int i = 1 - _idx;
+        _cam->_depthReady((const float *)data, _eye[i], _at[i], _zaxis[i]);
+    }
+};
+
+
+DepthCamera::DepthCamera()
+    : Camera(),
+      _depth(0), _points(0), _points_enabled(false), _depth_seq(0)
+{
+}
+
+DepthCamera::~DepthCamera()
+{
+    if (_depth)
+        delete [] _depth;
+    if (_points)
+        delete [] _points;
+}
+
+void DepthCamera::init(sim::Sim *sim)
+{
+    if (_atlas){
+        ERR("Depth camera can't be part of atlas.");
+        _atlas = 0;
+    }
+
+    _depth = new float[_width * _height];
+    for (int i = 0; i < _width * _height; i++)
+        _depth[i] = _far;
+
+    if (_points_enabled)
+        _points = new Vec3[_width * _height];
+
+    Camera::init(sim);
+}
+
+void DepthCamera::_createCamera()
+{
+    Camera::_createCamera();
+
+    _depth_tex = new osg::Texture2D;
+    _depth_tex->setTextureSize(_width, _height);
+    _depth_tex->setInternalFormat(GL_DEPTH_COMPONENT24);
+    _depth_tex->setSourceFormat(GL_DEPTH_COMPONENT);
+    _depth_tex->setSourceType(GL_FLOAT);
+    _depth_tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+    _depth_tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+
+    _cam->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+    _cam->attach(osg::Camera::DEPTH_BUFFER, _depth_tex.get());
+
+    // final draw callback is taken by color image
+    _cam->setPostDrawCallback(new DepthCameraReadback(this));
+}
+
+void DepthCamera::_depthReady(const float *data, const Vec3 &eye,
+                              const Vec3 &at, const Vec3 &zaxis)
+{
+    Scalar n = _near, f = _far;
+    Scalar z, ndc, tan_y, tan_x;
+    Vec3 fwd, up, right;
+    int i, x, y;
+
+    // linearize depth: invert perspective projection
+    for (i = 0; i < _width * _height; i++){
+        if (data[i] >= 1.f){
+            _depth[i] = f;
+        }else{
+            ndc = 2. * data[i] - 1.;
+            _depth[i] = (2. * n * f) / (f + n - ndc * (f - n));
+        }
+    }
+
+    if (_points){
+        // basis of camera in world coordinates
+        fwd = at - eye;
+        fwd.normalize();
+        right = fwd ^ zaxis;
+        right.normalize();
+        up = right ^ fwd;
+
+        tan_y = tan(_fovy * M_PI / 360.);
+        tan_x = tan_y * (Scalar)_width / (Scalar)_height;
+
+        i = 0;
+        for (y = 0; y < _height; y++){
+            for (x = 0; x < _width; x++, i++){
+                z = _depth[i];
+                _points[i] = eye + fwd * z
+                    + right * (z * tan_x * (2. * (x + .5) / _width - 1.))
+                    + up * (z * tan_y * (2. * (y + .5) / _height - 1.));
+            }
+        }
+    }
+
+    ++_depth_seq;
+}
+
+} /* namespace sensor */
+
+} /* namespace sim */
@@ -0,0 +1,104 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_SENSOR_DEPTHCAMERA_HPP_
+#define _SIM_SENSOR_DEPTHCAMERA_HPP_
+
+#include <sim/sensor/camera.hpp>
+
+namespace sim {
+
+namespace sensor {
+
+class DepthCameraReadback;
+
+/**
+ * Camera that also measures depth of each pixel.
+ *
+ * Depth buffer of camera is read back (asynchronously, with one frame
+ * latency as color image) and linearized into distances along view axis
+ * of camera. Optionally, each pixel is unprojected into point in world
+ * coordinates, which gives dense point cloud.
+ * Pixels where nothing was hit have depth equal to far plane (see
+ * Camera::setPerspective()) and their points are invalid.
+ *
+ * Depth camera can't be part of CameraAtlas.
+ */
+class DepthCamera : public Camera {
+    friend class DepthCameraReadback;
+
+  protected:
+    osg::ref_ptr<osg::Texture2D> _depth_tex; /*!< Depth buffer */
+    float *_depth; /*!< Linear depth of pixels */
+    Vec3 *_points; /*!< Point cloud in world coordinates */
+    bool _points_enabled;
+    unsigned long _depth_seq; /*!< Sequence number of depth data */
+
+  public:
+    DepthCamera();
+    ~DepthCamera();
+
+    /**
+     * Enables computing of point cloud. Must be called before init().
+     */
+    void enablePointCloud(bool yes = true) { _points_enabled = yes; }
+    bool pointCloudEnabled() const { return _points_enabled; }
+
+    /**
+     * Depths of all pixels (width() * height(), rows from bottom to top).
+     */
+    const float *depth() const { return _depth; }
+    float depth(int x, int y) const { return _depth[y * _width + x]; }
+
+    /**
+     * Returns true if something was hit in given pixel.
+     */
+    bool hit(int x, int y) const { return _depth[y * _width + x] < _far; }
+
+    /**
+     * Points of all pixels in world coordinates (same layout as depth()).
+     * Returns 0 if point cloud is not enabled.
+     */
+    const Vec3 *points() const { return _points; }
+    const Vec3 &point(int x, int y) const { return _points[y * _width + x]; }
+
+    /**
+     * Incremented each time new depth data are available.
+     */
+    unsigned long depthSeq() const { return _depth_seq; }
+
+    void init(sim::Sim *sim);
+
+  protected:
+    void _createCamera();
+
+    /**
+     * Stores depth buffer (floats in [0, 1]) taken from given pose.
+     */
+    void _depthReady(const float *data, const Vec3 &eye, const Vec3 &at,
+                     const Vec3 &zaxis);
+};
+
+} /* namespace sensor */
+
+} /* namespace sim */
+
+#endif /* _SIM_SENSOR_DEPTHCAMERA_HPP_ */
@@ -0,0 +1,202 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <osgDB/WriteFile>
+
+#include "imagedumper.hpp"
+#include <sim/msg.hpp>
+
+namespace sim {
+namespace sensor {
+
+ImageDumper::ImageDumper(const char *prefix, Mode mode,
+                         size_t slots, size_t threads)
+    : _prefix(prefix), _ext("png"), _mode(mode), _raw(0),
+      _slots(slots < 1 ? 1 : slots), _head(0), _tail(0),
+      _quit(false), _frames(0), _written(0), _dropped(0)
+{
+    pthread_t th;
+
+    for (size_t i = 0; i < _slots.size(); i++){
+        _slots[i].img = new osg::Image;
+        _slots[i].frame = 0;
+        _slots[i].state = SLOT_FREE;
+    }
+
+    if (_mode == MODE_RAW){
+        std::string fn = _prefix + "seq.raw";
+        _raw = fopen(fn.c_str(), "wb");
+        if (!_raw)
+            ERR("Can't open file " << fn << " for writing.");
+
+        // frames must be appended in order
+        threads = 1;
+    }
+
+    pthread_mutex_init(&_lock, NULL);
+    pthread_cond_init(&_cond, NULL);
+
+    for (size_t i = 0; i < threads; i++){
+        if (pthread_create(&th, NULL, _thread, (void *)this) != 0){
+            ERR("Can't create dumping thread.");
+            break;
+        }
+        _threads.push_back(th);
+    }
+}
+
+ImageDumper::~ImageDumper()
+{
+    pthread_mutex_lock(&_lock);
+    _quit = true;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_lock);
+
+    for (size_t i = 0; i < _threads.size(); i++){
+        pthread_join(_threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_lock);
+
+    if (_raw)
+        fclose(_raw);
+
+    DBG("Image dumper " << _prefix << ": " << _written << " written, "
+        << _dropped << " dropped");
+}
+
+bool ImageDumper::dump(const osg::Image *img)
+{
+    slot_t *slot;
+    osg::Image *dst;
+    size_t row;
+
+    if (!img->data())
+        return false;
+
+    pthread_mutex_lock(&_lock);
+    slot = &_slots[_head];
+    if (slot->state != SLOT_FREE){
+        ++_frames;
+        ++_dropped;
+        pthread_mutex_unlock(&_lock);
+        return false;
+    }
+    pthread_mutex_unlock(&_lock);
+
+    // slot is free so no worker touches it - copy image without lock
+    dst = slot->img.get();
+    if (dst->s() != img->s() || dst->t() != img->t() || dst->r() != img->r()
+            || dst->getPixelFormat() != img->getPixelFormat()
+            || dst->getDataType() != img->getDataType()){
+        dst->allocateImage(img->s(), img->t(), img->r(),
+                           img->getPixelFormat(), img->getDataType(),
+                           img->getPacking());
+    }
+
+    // source can have longer rows (see CameraAtlas) so copy by rows
+    row = dst->getRowSizeInBytes();
+    for (int r = 0; r < img->r(); r++){
+        for (int t = 0; t < img->t(); t++){
+            memcpy(dst->data(0, t, r), img->data(0, t, r), row);
+        }
+    }
+
+    pthread_mutex_lock(&_lock);
+    slot->frame = _frames++;
+    slot->state = SLOT_QUEUED;
+    _head = (_head + 1) % _slots.size();
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_lock);
+
+    return true;
+}
+
+void ImageDumper::_write(slot_t *slot)
+{
+    char fn[32];
+
+    if (_mode == MODE_RAW){
+        _writeRaw(slot);
+    }else{
+        snprintf(fn, 32, "%06lu.", slot->frame);
+        osgDB::writeImageFile(*slot->img, _prefix + fn + _ext);
+    }
+}
+
+void ImageDumper::_writeRaw(slot_t *slot)
+{
+    const osg::Image *img = slot->img.get();
+    uint32_t header[6];
+
+    if (!_raw)
+        return;
+
+    header[0] = 0x53494d46;
+    header[1] = slot->frame;
+    header[2] = img->s();
+    header[3] = img->t();
+    header[4] = img->getPixelFormat();
+    header[5] = img->getTotalSizeInBytes();
+
+    if (fwrite(header, sizeof(header), 1, _raw) != 1
+            || fwrite(img->data(), header[5], 1, _raw) != 1){
+        ERR("Can't write frame " << slot->frame << " into raw sequence.");
+    }
+}
+
+void *ImageDumper::_thread(void *arg)
+{
+    ImageDumper *d = (ImageDumper *)arg;
+    slot_t *slot;
+
+    pthread_mutex_lock(&d->_lock);
+    while (1){
+        slot = &d->_slots[d->_tail];
+
+        // queued images are written even when quitting
+        if (slot->state != SLOT_QUEUED){
+            if (d->_quit)
+                break;
+            pthread_cond_wait(&d->_cond, &d->_lock);
+            continue;
+        }
+
+        slot->state = SLOT_BUSY;
+        d->_tail = (d->_tail + 1) % d->_slots.size();
+        pthread_mutex_unlock(&d->_lock);
+
+        d->_write(slot);
+
+        pthread_mutex_lock(&d->_lock);
+        slot->state = SLOT_FREE;
+        ++d->_written;
+    }
+    pthread_mutex_unlock(&d->_lock);
+
+    return NULL;
+}
+
+} /* namespace sensor */
+
+} /* namespace sim */
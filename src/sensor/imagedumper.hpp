@@ -0,0 +1,129 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_SENSOR_IMAGEDUMPER_HPP_
+#define _SIM_SENSOR_IMAGEDUMPER_HPP_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+#include <string>
+#include <osg/Image>
+
+namespace sim {
+
+namespace sensor {
+
+/**
+ * Writes images to disk in background.
+ *
+ * dump() only copies image into one of preallocated slots of bounded ring
+ * and returns, images are written by worker threads. If all slots are
+ * occupied the image is dropped (and counted) so the caller is never
+ * blocked.
+ *
+ * Images are either encoded into separate files named
+ * <prefix>NNNNNN.png (format is given by extension, see setExtension()),
+ * or appended into one raw sequence file <prefix>seq.raw. Each frame of
+ * raw file consists of header of six uint32_t in host byte order - magic
+ * 0x53494d46 ("SIMF"), frame number, width, height, GL pixel format and
+ * size of data in bytes - followed by image data (rows from bottom to
+ * top).
+ */
+class ImageDumper {
+  public:
+    enum Mode {
+        MODE_FILES = 0, /*!< One encoded file per image */
+        MODE_RAW        /*!< Raw sequence file */
+    };
+
+  protected:
+    enum {
+        SLOT_FREE = 0,
+        SLOT_QUEUED,
+        SLOT_BUSY
+    };
+
+    struct slot_t {
+        osg::ref_ptr<osg::Image> img;
+        unsigned long frame;
+        int state;
+    };
+
+    std::string _prefix;
+    std::string _ext;
+    Mode _mode;
+    FILE *_raw; /*!< Raw sequence file */
+
+    std::vector<slot_t> _slots; /*!< Ring of slots */
+    size_t _head; /*!< Next slot to fill */
+    size_t _tail; /*!< Next slot to write */
+
+    std::vector<pthread_t> _threads;
+    pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+    bool _quit;
+
+    unsigned long _frames; /*!< Number of frames passed to dump() */
+    unsigned long _written; /*!< Number of written frames */
+    unsigned long _dropped; /*!< Number of dropped frames */
+
+  public:
+    /**
+     * Creates dumper with given number of slots and worker threads
+     * (raw sequence is always written by one thread).
+     */
+    ImageDumper(const char *prefix, Mode mode = MODE_FILES,
+                size_t slots = 16, size_t threads = 2);
+
+    /**
+     * Writes all queued images and stops worker threads.
+     */
+    ~ImageDumper();
+
+    /**
+     * Sets extension (and thus format) of written files (default "png").
+     */
+    void setExtension(const char *ext) { _ext = ext; }
+
+    /**
+     * Queues copy of image for writing. Returns false if image was
+     * dropped.
+     */
+    bool dump(const osg::Image *img);
+
+    unsigned long frames() const { return _frames; }
+    unsigned long written() const { return _written; }
+    unsigned long dropped() const { return _dropped; }
+
+  protected:
+    void _write(slot_t *slot);
+    void _writeRaw(slot_t *slot);
+
+    static void *_thread(void *);
+};
+
+} /* namespace sensor */
+
+} /* namespace sim */
+
+#endif /* _SIM_SENSOR_IMAGEDUMPER_HPP_ */
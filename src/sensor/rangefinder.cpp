@@ -22,6 +22,7 @@
 #include <osg/ShapeDrawable>
 
 #include "rangefinder.hpp"
+#include "sensorhub.hpp"
 #include "sim/msg.hpp"
 
 namespace sim {
@@ -31,11 +32,14 @@ namespace sensor {
 RangeFinder::RangeFinder(Scalar max_range, size_t num_beams, Scalar angle_range)
     : sim::Component(),
       _max_range(max_range), _num_beams(num_beams), _angle_range(angle_range),
+      _engine(0), _own_beams(true), _hub(0), _threads(1), _body(0),
       _offset_pos(0., 0., 0.), _offset_rot(0., 0., 0., 1.),
+      _pos_valid(false), _data_valid(false),
+      _scans_traced(0), _scans_skipped(0),
       _vis_enabled(false)
 {
-    _intersectors = new osgUtil::IntersectorGroup;
-    _visitor = new osgUtil::IntersectionVisitor(_intersectors);
+    _rays = new Ray[_num_beams];
+    _hits = new RayHit[_num_beams];
 
     _data.detected = new bool[_num_beams];
     _data.dist = new Scalar[_num_beams];
@@ -49,6 +53,13 @@ RangeFinder::RangeFinder(Scalar max_range, size_t num_beams, Scalar angle_range)
 
 RangeFinder::~RangeFinder()
 {
+    if (_hub)
+        _hub->rmRangeFinder(this);
+
+    if (_own_beams){
+        delete [] _rays;
+        delete [] _hits;
+    }
     delete [] _data.detected;
     delete [] _data.dist;
     delete [] _data.point;
@@ -59,9 +70,7 @@ void RangeFinder::init(sim::Sim *sim)
 {
     _sim = sim;
 
-    _sim->regPreStep(this);
-
-    _createIntersectors();
+    _engine = RayEngine::get(_sim);
 
     if (_vis_enabled)
         _createVis();
@@ -70,72 +79,74 @@ void RangeFinder::init(sim::Sim *sim)
         _sim->visWorld()->addOffScene(_vis.get());
 
     _updatePosition();
+
+    if (_hub){
+        // hub takes over beams and traces them in its own pre-step
+        _hub->addRangeFinder(this);
+    }else{
+        _sim->regPreStep(this);
+    }
 }
 
 void RangeFinder::finish()
 {
+    DBG("Range finder: " << _scans_traced << " scans traced, "
+        << _scans_skipped << " skipped");
+
     if (_vis.valid())
         _sim->visWorld()->rmOffScene(_vis.get());
 }
 
 void RangeFinder::cbPreStep()
 {
-    osg::Node *root;
+    if (!_needsTrace())
+        return;
 
-    if (_body)
-        _updatePosition();
+    _engine->trace(_rays, _num_beams, _hits, _threads);
 
-    // get root of scene
-    root = _sim->visWorld()->sceneRoot();
+    _updateData();
+}
 
-    // traverse scene
-    root->accept(*_visitor.get());
+bool RangeFinder::_needsTrace()
+{
+    bool moved = false;
 
-    // gather measured data
-    osgUtil::LineSegmentIntersector *is;
-    osgUtil::LineSegmentIntersector::Intersection inter;
-    osgUtil::IntersectorGroup::Intersectors &its = _intersectors->getIntersectors();
+    if (_body)
+        moved = _updatePosition();
 
-    for (size_t i = 0; i < _num_beams; i++){
-        is = (osgUtil::LineSegmentIntersector *)its[i].get();
+    if (!moved && _data_valid && !_engine->changed(_range_min, _range_max)){
+        ++_scans_skipped;
+        return false;
+    }
 
-        if (is->containsIntersections()){
-            inter = is->getFirstIntersection();
+    return true;
+}
 
-            _data.detected[i] = true;
-            _data.point[i] = inter.getWorldIntersectPoint();
-            _data.local[i] = inter.getWorldIntersectPoint() - is->getStart();
-            _data.dist[i] = _data.local[i].length();
 
-            //std::cerr << _data.detected[i] << ":" << _data.dist[i] << " ";
+void RangeFinder::_updateData()
+{
+    for (size_t i = 0; i < _num_beams; i++){
+        if (_hits[i].hit){
+            _data.detected[i] = true;
+            _data.point[i] = _hits[i].point;
+            _data.local[i] = _hits[i].point - _rays[i].from;
+            _data.dist[i] = _hits[i].dist;
         }else{
             _data.detected[i] = false;
             _data.dist[i] = _max_range;
-            _data.point[i] = is->getEnd();
-            _data.local[i] = is->getEnd() - is->getStart();
+            _data.point[i] = _rays[i].to;
+            _data.local[i] = _rays[i].to - _rays[i].from;
         }
-
-        // clear list of intersections
-        is->getIntersections().clear();
     }
 
-    //std::cerr << std::endl;
+    _data_valid = true;
+    ++_scans_traced;
 
     if (_vis.valid())
         _updateVis();
 }
 
 
-void RangeFinder::_createIntersectors()
-{
-    osgUtil::LineSegmentIntersector *beam;
-
-    for (size_t i = 0; i < _num_beams; i++){
-        beam = new osgUtil::LineSegmentIntersector(Vec3(0., 0., 0.), Vec3(0., 0., 0.));
-        _intersectors->addIntersector(beam);
-    }
-}
-
 void RangeFinder::_createVis()
 {
     Scalar size = 0.01;
@@ -182,7 +193,7 @@ void RangeFinder::_createVis()
 }
 
 
-void RangeFinder::_updatePosition()
+bool RangeFinder::_updatePosition()
 {
     Vec3 pos;
     Quat rot;
@@ -195,29 +206,32 @@ void RangeFinder::_updatePosition()
         rot = _offset_rot;
     }
 
+    if (_pos_valid && pos == _pos && rot == _rot)
+        return false;
+
+    _pos = pos;
+    _rot = rot;
+    _pos_valid = true;
+
+    for (size_t i = 0; i < 3; i++){
+        _range_min[i] = pos[i] - _max_range;
+        _range_max[i] = pos[i] + _max_range;
+    }
+
     Scalar angle, angle_step;
-    Vec3 from(0., 0., 0.), to, to_dir(_max_range, 0., 0.);
+    Vec3 to_dir(_max_range, 0., 0.);
 
     angle = -_angle_range / 2.;
     angle_step = _angle_range / (Scalar)(_num_beams - 1);
 
-    osgUtil::LineSegmentIntersector *is;
-    osgUtil::IntersectorGroup::Intersectors &its = _intersectors->getIntersectors();
     for (size_t i = 0; i < _num_beams; i++){
-        is = (osgUtil::LineSegmentIntersector *)its[i].get();
-
-        from = Vec3(0., 0., 0.);
-        to = Quat(Vec3(0., 0., 1.), angle) * to_dir;
-
-        from += pos;
-        to += pos;
-        to = rot * to;
-
-        is->setStart(from);
-        is->setEnd(to);
+        _rays[i].from = pos;
+        _rays[i].to = pos + rot * (Quat(Vec3(0., 0., 1.), angle) * to_dir);
 
         angle += angle_step;
     }
+
+    return true;
 }
 
 void RangeFinder::_updateVis()
@@ -237,12 +251,8 @@ void RangeFinder::_updateVis()
         }
     }
 
-
-    osgUtil::LineSegmentIntersector *is;
-    osgUtil::IntersectorGroup::Intersectors &its = _intersectors->getIntersectors();
-    is = (osgUtil::LineSegmentIntersector *)its[0].get();
     tr = (osg::PositionAttitudeTransform *)_vis->getChild(_num_beams);
-    tr->setPosition(is->getStart());
+    tr->setPosition(_rays[0].from);
 }
 
 }
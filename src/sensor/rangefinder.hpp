@@ -23,12 +23,17 @@
 #define _SIM_SENSOR_RANGEFINDER_HPP_
 
 #include <sim/sim.hpp>
+#include <sim/sensor/rayengine.hpp>
 
 namespace sim {
 
 namespace sensor {
 
+class SensorHub;
+
 class RangeFinder : public sim::Component {
+    friend class SensorHub;
+
   protected:
     sim::Sim *_sim;
 
@@ -36,13 +41,27 @@ class RangeFinder : public sim::Component {
     size_t _num_beams;
     Scalar _angle_range;
 
-    osg::ref_ptr<osgUtil::IntersectorGroup> _intersectors;
-    osg::ref_ptr<osgUtil::IntersectionVisitor> _visitor;
+    RayEngine *_engine; //!< Engine used for tracing beams
+    Ray *_rays; //!< Beams in world coordinates
+    RayHit *_hits; //!< Closest hits of beams
+    bool _own_beams; //!< True if _rays and _hits are owned by range finder
+
+    SensorHub *_hub; //!< Hub tracing beams of this range finder or 0
+    size_t _threads; //!< Number of threads used for tracing beams
 
     const sim::Body *_body; //!< Body sensor is attached to
     Vec3 _offset_pos;
     Quat _offset_rot;
 
+    Vec3 _pos; //!< Current position of sensor in world coordinates
+    Quat _rot; //!< Current rotation of sensor
+    bool _pos_valid; //!< True if beams correspond to _pos and _rot
+    bool _data_valid; //!< True if _data holds results of last trace
+    Vec3 _range_min, _range_max; //!< Box enclosing all beams
+
+    unsigned long _scans_traced; //!< Number of scans actually traced
+    unsigned long _scans_skipped; //!< Number of scans reused from cache
+
     struct {
         bool *detected; //!< Holds info whetever obstacle was detected by beam
         Scalar *dist; //!< Distances of obstacles
@@ -62,6 +81,13 @@ class RangeFinder : public sim::Component {
     Scalar angleRange() const { return _angle_range; }
     void enableVis(bool yes = true) { _vis_enabled = yes; }
 
+    /**
+     * Sets number of threads beams are traced by (default 1).
+     * Has no effect if range finder is traced by hub (see SensorHub).
+     */
+    void setNumThreads(size_t threads) { _threads = threads; }
+    size_t numThreads() const { return _threads; }
+
     const bool *detected() const { return _data.detected; }
     bool detected(size_t i) const { return _data.detected[i]; }
     const Scalar *distance() const { return _data.dist; }
@@ -79,14 +105,39 @@ class RangeFinder : public sim::Component {
                       const Quat &rot = Quat(0., 0., 0., 1.))
         { _body = b; _offset_pos = pos; _offset_rot = rot; }
 
+    /**
+     * Range finder's beams will be traced by given hub together with
+     * beams of all other range finders registered in it.
+     * Must be called before component is initialized.
+     */
+    void setHub(SensorHub *hub) { _hub = hub; }
+    SensorHub *hub() { return _hub; }
+
+    /**
+     * Number of scans that were traced and that were skipped because
+     * neither sensor nor anything in its range moved.
+     */
+    unsigned long scansTraced() const { return _scans_traced; }
+    unsigned long scansSkipped() const { return _scans_skipped; }
+
     void init(sim::Sim *sim);
     void finish();
     void cbPreStep();
 
   protected:
-    void _createIntersectors();
     void _createVis();
-    void _updatePosition();
+    /**
+     * Updates beams according to current position of sensor.
+     * Returns true if position changed.
+     */
+    bool _updatePosition();
+
+    /**
+     * Returns true if beams must be traced again, i.e., if sensor moved
+     * or if something in its range moved.
+     */
+    bool _needsTrace();
+    void _updateData();
     void _updateVis();
 };
 
@@ -0,0 +1,1025 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <osg/NodeVisitor>
+#include <osg/Geode>
+#include <osg/TriangleFunctor>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif /* __SSE2__ */
+
+#include "rayengine.hpp"
+#include "sim/msg.hpp"
+
+namespace sim {
+
+namespace sensor {
+
+/** Maximal depth of traversal stack */
+#define STACK_SIZE 256
+
+/** Number of rays worker takes at once */
+#define JOB_CHUNK 16
+
+typedef RayEngine::node_t node_t;
+typedef RayEngine::tri4_t tri4_t;
+typedef RayEngine::mesh_t mesh_t;
+typedef RayEngine::inst_t inst_t;
+
+
+/**
+ * Collects triangles of osg subtree.
+ */
+struct TriAdd {
+    std::vector<float> *tris;
+    osg::Matrixd m;
+
+    void add(const osg::Vec3 &v1, const osg::Vec3 &v2, const osg::Vec3 &v3)
+    {
+        osg::Vec3d v[3] = { v1 * m, v2 * m, v3 * m };
+        for (int i = 0; i < 3; i++){
+            tris->push_back(v[i].x());
+            tris->push_back(v[i].y());
+            tris->push_back(v[i].z());
+        }
+    }
+
+    void operator()(const osg::Vec3 &v1, const osg::Vec3 &v2, const osg::Vec3 &v3,
+                    bool temp)
+        { add(v1, v2, v3); }
+    void operator()(const osg::Vec3 &v1, const osg::Vec3 &v2, const osg::Vec3 &v3)
+        { add(v1, v2, v3); }
+};
+
+class TriCollector : public osg::NodeVisitor {
+    std::vector<float> *_tris;
+
+  public:
+    TriCollector(std::vector<float> *tris)
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+          _tris(tris) {}
+
+    void apply(osg::Geode &geode)
+    {
+        osg::TriangleFunctor<TriAdd> f;
+
+        f.tris = _tris;
+        f.m = osg::computeLocalToWorld(getNodePath());
+        for (unsigned int i = 0; i < geode.getNumDrawables(); i++){
+            geode.getDrawable(i)->accept(f);
+        }
+    }
+};
+
+
+/**
+ * Primitive used during building of hierarchy.
+ */
+struct bprim_t {
+    float min[3], max[3], c[3];
+    int idx;
+};
+
+struct bprim_cmp_t {
+    int axis;
+    bprim_cmp_t(int a) : axis(a) {}
+    bool operator()(const bprim_t &a, const bprim_t &b) const
+        { return a.c[axis] < b.c[axis]; }
+};
+
+static void bprimBounds(const bprim_t *p, int len, float *min, float *max)
+{
+    for (int a = 0; a < 3; a++){
+        min[a] = FLT_MAX;
+        max[a] = -FLT_MAX;
+    }
+
+    for (int i = 0; i < len; i++){
+        for (int a = 0; a < 3; a++){
+            min[a] = std::min(min[a], p[i].min[a]);
+            max[a] = std::max(max[a], p[i].max[a]);
+        }
+    }
+}
+
+/**
+ * Builder of 4-ary BVH. Each level splits primitives into (up to) four
+ * parts by median of centroids along longest axis.
+ */
+class BVHBuilder {
+  protected:
+    std::vector<node_t> *_nodes;
+    int _leaf_size;
+
+  public:
+    BVHBuilder(std::vector<node_t> *nodes, int leaf_size)
+        : _nodes(nodes), _leaf_size(leaf_size) {}
+    virtual ~BVHBuilder() {}
+
+    /**
+     * Builds subtree and returns code of its root (see node_t).
+     */
+    int build(bprim_t *p, int len)
+    {
+        int start[4], num[4], parts = 0;
+        int id, child;
+        float min[3], max[3];
+
+        if (len <= _leaf_size)
+            return leaf(p, len);
+
+        // split into halves and each half into halves again
+        int mid = split(p, len);
+        int halves[2][2] = { { 0, mid }, { mid, len } };
+        for (int h = 0; h < 2; h++){
+            int b = halves[h][0], l = halves[h][1] - halves[h][0];
+            if (l > _leaf_size){
+                int m = split(p + b, l);
+                start[parts] = b;
+                num[parts++] = m;
+                start[parts] = b + m;
+                num[parts++] = l - m;
+            }else{
+                start[parts] = b;
+                num[parts++] = l;
+            }
+        }
+
+        id = _nodes->size();
+        _nodes->push_back(node_t());
+        for (int k = 0; k < 4; k++){
+            (*_nodes)[id].child[k] = -1;
+            for (int a = 0; a < 3; a++){
+                (*_nodes)[id].min[a][k] = 0.f;
+                (*_nodes)[id].max[a][k] = 0.f;
+            }
+        }
+
+        for (int k = 0; k < parts; k++){
+            child = build(p + start[k], num[k]);
+            bprimBounds(p + start[k], num[k], min, max);
+
+            // vector could be reallocated during recursion
+            node_t &n = (*_nodes)[id];
+            n.child[k] = child;
+            for (int a = 0; a < 3; a++){
+                n.min[a][k] = min[a];
+                n.max[a][k] = max[a];
+            }
+        }
+
+        return id;
+    }
+
+  protected:
+    virtual int leaf(bprim_t *p, int len) = 0;
+
+    /**
+     * Partially sorts primitives by median along longest axis of
+     * centroids. Returns size of first part.
+     */
+    int split(bprim_t *p, int len)
+    {
+        float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        int axis = 0;
+
+        for (int i = 0; i < len; i++){
+            for (int a = 0; a < 3; a++){
+                min[a] = std::min(min[a], p[i].c[a]);
+                max[a] = std::max(max[a], p[i].c[a]);
+            }
+        }
+        for (int a = 1; a < 3; a++){
+            if (max[a] - min[a] > max[axis] - min[axis])
+                axis = a;
+        }
+
+        std::nth_element(p, p + len / 2, p + len, bprim_cmp_t(axis));
+        return len / 2;
+    }
+};
+
+/**
+ * Builder of mesh hierarchy - leaves are packets of four triangles.
+ */
+class MeshBuilder : public BVHBuilder {
+    mesh_t *_mesh;
+
+  public:
+    MeshBuilder(mesh_t *mesh)
+        : BVHBuilder(&mesh->nodes, 4), _mesh(mesh) {}
+
+  protected:
+    int leaf(bprim_t *p, int len)
+    {
+        tri4_t t;
+        const float *v;
+
+        // unused lanes stay degenerate and are never hit
+        memset(&t, 0, sizeof(t));
+        for (int k = 0; k < len; k++){
+            v = &_mesh->tris[9 * p[k].idx];
+            for (int a = 0; a < 3; a++){
+                t.v0[a][k] = v[a];
+                t.e1[a][k] = v[3 + a] - v[a];
+                t.e2[a][k] = v[6 + a] - v[a];
+            }
+        }
+
+        _mesh->packets.push_back(t);
+        return -(int)(_mesh->packets.size() - 1) - 2;
+    }
+};
+
+/**
+ * Builder of top level hierarchy - leaves are single instances.
+ */
+class InstBuilder : public BVHBuilder {
+  public:
+    InstBuilder(std::vector<node_t> *nodes)
+        : BVHBuilder(nodes, 1) {}
+
+  protected:
+    int leaf(bprim_t *p, int len)
+    {
+        return -p[0].idx - 2;
+    }
+};
+
+
+
+/**
+ * Ray prepared for traversal.
+ */
+struct ray_t {
+    float org[3], dir[3], inv[3];
+};
+
+/**
+ * Closest hit found so far.
+ */
+struct hit_t {
+    float t;
+    int inst;
+    const tri4_t *packet;
+    int lane;
+};
+
+static void rayInit(ray_t *r, const double *org, const double *dir)
+{
+    for (int a = 0; a < 3; a++){
+        r->org[a] = org[a];
+        r->dir[a] = dir[a];
+        if (fabs(dir[a]) > 1E-12){
+            r->inv[a] = 1. / dir[a];
+        }else{
+            r->inv[a] = (dir[a] < 0. ? -1E30f : 1E30f);
+        }
+    }
+}
+
+#ifdef __SSE2__
+static inline int boxes4(const node_t *n, const ray_t &r, float tmax, float *tnear)
+{
+    __m128 t0 = _mm_setzero_ps();
+    __m128 t1 = _mm_set1_ps(tmax);
+    __m128 o, inv, lo, hi;
+
+    for (int a = 0; a < 3; a++){
+        o = _mm_set1_ps(r.org[a]);
+        inv = _mm_set1_ps(r.inv[a]);
+        lo = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n->min[a]), o), inv);
+        hi = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n->max[a]), o), inv);
+        t0 = _mm_max_ps(t0, _mm_min_ps(lo, hi));
+        t1 = _mm_min_ps(t1, _mm_max_ps(lo, hi));
+    }
+
+    _mm_storeu_ps(tnear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+
+static inline void tris4(const tri4_t *p, const ray_t &r, hit_t *hit, int inst)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 dx = _mm_set1_ps(r.dir[0]);
+    __m128 dy = _mm_set1_ps(r.dir[1]);
+    __m128 dz = _mm_set1_ps(r.dir[2]);
+    __m128 e1x = _mm_loadu_ps(p->e1[0]);
+    __m128 e1y = _mm_loadu_ps(p->e1[1]);
+    __m128 e1z = _mm_loadu_ps(p->e1[2]);
+    __m128 e2x = _mm_loadu_ps(p->e2[0]);
+    __m128 e2y = _mm_loadu_ps(p->e2[1]);
+    __m128 e2z = _mm_loadu_ps(p->e2[2]);
+    __m128 px, py, pz, qx, qy, qz, tx, ty, tz;
+    __m128 det, inv, u, v, t, mask;
+    float ts[4];
+    int m;
+
+    // p = dir x e2
+    px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+                     _mm_mul_ps(e1z, pz));
+    mask = _mm_cmpgt_ps(_mm_and_ps(det, abs_mask), _mm_set1_ps(1E-20f));
+    if (!_mm_movemask_ps(mask))
+        return;
+    inv = _mm_div_ps(one, det);
+
+    // t = org - v0
+    tx = _mm_sub_ps(_mm_set1_ps(r.org[0]), _mm_loadu_ps(p->v0[0]));
+    ty = _mm_sub_ps(_mm_set1_ps(r.org[1]), _mm_loadu_ps(p->v0[1]));
+    tz = _mm_sub_ps(_mm_set1_ps(r.org[2]), _mm_loadu_ps(p->v0[2]));
+    u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)),
+                              _mm_mul_ps(tz, pz)), inv);
+
+    // q = t x e1
+    qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)),
+                              _mm_mul_ps(dz, qz)), inv);
+    t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)),
+                              _mm_mul_ps(e2z, qz)), inv);
+
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, zero));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(hit->t)));
+
+    m = _mm_movemask_ps(mask);
+    if (!m)
+        return;
+
+    _mm_storeu_ps(ts, t);
+    for (int k = 0; k < 4; k++){
+        if ((m & (1 << k)) && ts[k] < hit->t){
+            hit->t = ts[k];
+            hit->inst = inst;
+            hit->packet = p;
+            hit->lane = k;
+        }
+    }
+}
+
+#else /* __SSE2__ */
+
+static inline int boxes4(const node_t *n, const ray_t &r, float tmax, float *tnear)
+{
+    float t0, t1, lo, hi;
+    int mask = 0;
+
+    for (int k = 0; k < 4; k++){
+        t0 = 0.f;
+        t1 = tmax;
+        for (int a = 0; a < 3; a++){
+            lo = (n->min[a][k] - r.org[a]) * r.inv[a];
+            hi = (n->max[a][k] - r.org[a]) * r.inv[a];
+            t0 = std::max(t0, std::min(lo, hi));
+            t1 = std::min(t1, std::max(lo, hi));
+        }
+
+        tnear[k] = t0;
+        if (t0 <= t1)
+            mask |= (1 << k);
+    }
+
+    return mask;
+}
+
+static inline void tris4(const tri4_t *p, const ray_t &r, hit_t *hit, int inst)
+{
+    float pv[3], tv[3], qv[3];
+    float det, inv, u, v, t;
+
+    for (int k = 0; k < 4; k++){
+        pv[0] = r.dir[1] * p->e2[2][k] - r.dir[2] * p->e2[1][k];
+        pv[1] = r.dir[2] * p->e2[0][k] - r.dir[0] * p->e2[2][k];
+        pv[2] = r.dir[0] * p->e2[1][k] - r.dir[1] * p->e2[0][k];
+        det = p->e1[0][k] * pv[0] + p->e1[1][k] * pv[1] + p->e1[2][k] * pv[2];
+        if (fabsf(det) <= 1E-20f)
+            continue;
+        inv = 1.f / det;
+
+        for (int a = 0; a < 3; a++)
+            tv[a] = r.org[a] - p->v0[a][k];
+        u = (tv[0] * pv[0] + tv[1] * pv[1] + tv[2] * pv[2]) * inv;
+        if (u < 0.f || u > 1.f)
+            continue;
+
+        qv[0] = tv[1] * p->e1[2][k] - tv[2] * p->e1[1][k];
+        qv[1] = tv[2] * p->e1[0][k] - tv[0] * p->e1[2][k];
+        qv[2] = tv[0] * p->e1[1][k] - tv[1] * p->e1[0][k];
+        v = (r.dir[0] * qv[0] + r.dir[1] * qv[1] + r.dir[2] * qv[2]) * inv;
+        if (v < 0.f || u + v > 1.f)
+            continue;
+
+        t = (p->e2[0][k] * qv[0] + p->e2[1][k] * qv[1] + p->e2[2][k] * qv[2]) * inv;
+        if (t > 0.f && t < hit->t){
+            hit->t = t;
+            hit->inst = inst;
+            hit->packet = p;
+            hit->lane = k;
+        }
+    }
+}
+#endif /* __SSE2__ */
+
+/**
+ * Traverses hierarchy - calls leaf callback on each leaf hit by ray.
+ * Children are visited front to back so farther subtrees can be skipped
+ * once closer hit is known.
+ */
+template <typename LEAF>
+static void traverse(const std::vector<node_t> &nodes, int root,
+                     const ray_t &r, hit_t *hit, LEAF &leaf)
+{
+    int stack[STACK_SIZE];
+    float stack_t[STACK_SIZE];
+    int sp = 0;
+    int code, mask, order[4], num;
+    float tnear[4];
+    const node_t *n;
+
+    stack[sp] = root;
+    stack_t[sp++] = 0.f;
+
+    while (sp > 0){
+        --sp;
+        code = stack[sp];
+        if (stack_t[sp] > hit->t)
+            continue;
+
+        if (code <= -2){
+            leaf(-code - 2, r, hit);
+            continue;
+        }else if (code < 0){
+            continue;
+        }
+
+        n = &nodes[code];
+        mask = boxes4(n, r, hit->t, tnear);
+
+        // sort hit children by entry distance (insertion sort)
+        num = 0;
+        for (int k = 0; k < 4; k++){
+            if (!(mask & (1 << k)) || n->child[k] == -1)
+                continue;
+
+            int j = num++;
+            while (j > 0 && tnear[order[j - 1]] < tnear[k]){
+                order[j] = order[j - 1];
+                --j;
+            }
+            order[j] = k;
+        }
+
+        // push farthest first so nearest is popped first
+        for (int k = 0; k < num && sp < STACK_SIZE; k++){
+            stack[sp] = n->child[order[k]];
+            stack_t[sp++] = tnear[order[k]];
+        }
+    }
+}
+
+struct MeshLeaf {
+    const mesh_t *mesh;
+    int inst;
+
+    void operator()(int idx, const ray_t &r, hit_t *hit)
+        { tris4(&mesh->packets[idx], r, hit, inst); }
+};
+
+struct InstLeaf {
+    const std::vector<inst_t> *insts;
+
+    void operator()(int idx, const ray_t &r, hit_t *hit)
+    {
+        const inst_t &inst = (*insts)[idx];
+        double org[3], dir[3], d[3];
+        ray_t lr;
+        MeshLeaf leaf;
+
+        // transform ray into local coordinates of instance
+        for (int a = 0; a < 3; a++)
+            d[a] = r.org[a] - inst.pos[a];
+        for (int a = 0; a < 3; a++){
+            org[a] = inst.to_local[a][0] * d[0]
+                        + inst.to_local[a][1] * d[1]
+                        + inst.to_local[a][2] * d[2];
+            dir[a] = inst.to_local[a][0] * r.dir[0]
+                        + inst.to_local[a][1] * r.dir[1]
+                        + inst.to_local[a][2] * r.dir[2];
+        }
+        rayInit(&lr, org, dir);
+
+        leaf.mesh = inst.mesh;
+        leaf.inst = idx;
+        traverse(inst.mesh->nodes, inst.mesh->root, lr, hit, leaf);
+    }
+};
+
+
+
+RayEngine::RayEngine()
+    : sim::Component(),
+      _root(-1), _bodies_gen(0), _updated(false), _rebuilt(false),
+      _job_id(0), _job_running(0), _pool_quit(false)
+{
+    pthread_mutex_init(&_pool_lock, NULL);
+    pthread_cond_init(&_pool_start, NULL);
+    pthread_cond_init(&_pool_done, NULL);
+}
+
+RayEngine::~RayEngine()
+{
+    pthread_mutex_lock(&_pool_lock);
+    _pool_quit = true;
+    pthread_cond_broadcast(&_pool_start);
+    pthread_mutex_unlock(&_pool_lock);
+
+    for (size_t i = 0; i < _workers.size(); i++){
+        pthread_join(_workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&_pool_done);
+    pthread_cond_destroy(&_pool_start);
+    pthread_mutex_destroy(&_pool_lock);
+
+    for (_meshes_t::iterator it = _meshes.begin(); it != _meshes.end(); ++it){
+        delete it->second;
+    }
+    _meshes.clear();
+    _vis_meshes.clear();
+}
+
+RayEngine *RayEngine::get(sim::Sim *sim)
+{
+    std::list<Component *> cs;
+    std::list<Component *>::iterator it;
+    RayEngine *e;
+
+    sim->components(&cs);
+    for (it = cs.begin(); it != cs.end(); ++it){
+        e = dynamic_cast<RayEngine *>(*it);
+        if (e)
+            return e;
+    }
+
+    e = new RayEngine();
+    e->setSim(sim);
+    sim->addComponent(e);
+    return e;
+}
+
+void RayEngine::init(sim::Sim *sim)
+{
+    _sim = sim;
+}
+
+void RayEngine::update()
+{
+    VisWorld *vw = _sim->visWorld();
+
+    // nothing to build hierarchy from, see trace()
+    if (!vw)
+        return;
+
+    if (_updated && _updated_time == _sim->timeSimulated())
+        return;
+
+    _moved.clear();
+    if (!_updated || _bodies_gen != vw->bodiesGen()){
+        _rebuild();
+        _rebuilt = true;
+    }else{
+        _refit();
+        _rebuilt = false;
+    }
+
+    _updated = true;
+    _updated_time = _sim->timeSimulated();
+}
+
+size_t RayEngine::trace(const Ray *rays, size_t n, RayHit *out)
+{
+    // without VisWorld (physics-only runs) rays are traced by physics
+    // engine
+    if (!_sim->visWorld())
+        return _sim->world()->castRays(rays, n, out);
+
+    update();
+    return _trace(rays, n, out);
+}
+
+size_t RayEngine::trace(const Ray *rays, size_t n, RayHit *out, size_t threads)
+{
+    pthread_t th;
+
+    if (threads <= 1 || n <= JOB_CHUNK || !_sim->visWorld())
+        return trace(rays, n, out);
+
+    update();
+
+    pthread_mutex_lock(&_pool_lock);
+
+    // create missing workers
+    while (_workers.size() < threads - 1){
+        if (pthread_create(&th, NULL, _workerThread, (void *)this) != 0){
+            ERR("Can't create ray tracing thread.");
+            break;
+        }
+        _workers.push_back(th);
+    }
+
+    _job.rays = rays;
+    _job.out = out;
+    _job.len = n;
+    _job.next = 0;
+    _job.hits = 0;
+    _job.workers = std::min(threads - 1, _workers.size());
+    _job.joined = 0;
+    _job_running = _job.workers;
+    ++_job_id;
+    pthread_cond_broadcast(&_pool_start);
+    pthread_mutex_unlock(&_pool_lock);
+
+    // calling thread works too
+    _work();
+
+    pthread_mutex_lock(&_pool_lock);
+    while (_job_running > 0)
+        pthread_cond_wait(&_pool_done, &_pool_lock);
+    pthread_mutex_unlock(&_pool_lock);
+
+    return _job.hits;
+}
+
+bool RayEngine::changed(const Vec3 &min, const Vec3 &max)
+{
+    if (!_sim->visWorld())
+        return true;
+
+    update();
+
+    if (_rebuilt)
+        return true;
+
+    for (size_t i = 0; i < _moved.size(); i++){
+        const box_t &b = _moved[i];
+        if (b.min[0] <= max[0] && b.max[0] >= min[0]
+                && b.min[1] <= max[1] && b.max[1] >= min[1]
+                && b.min[2] <= max[2] && b.max[2] >= min[2])
+            return true;
+    }
+
+    return false;
+}
+
+void RayEngine::_work()
+{
+    size_t from, len, hits;
+
+    while (1){
+        from = __sync_fetch_and_add(&_job.next, JOB_CHUNK);
+        if (from >= _job.len)
+            break;
+
+        len = std::min((size_t)JOB_CHUNK, _job.len - from);
+        hits = _trace(_job.rays + from, len, _job.out + from);
+        __sync_fetch_and_add(&_job.hits, hits);
+    }
+}
+
+void *RayEngine::_workerThread(void *arg)
+{
+    RayEngine *e = (RayEngine *)arg;
+    unsigned long job_id = 0;
+
+    // workers are created only from trace() for the job being
+    // published, so job_id = 0 makes the worker join it right away
+    pthread_mutex_lock(&e->_pool_lock);
+    while (1){
+        while (!e->_pool_quit && e->_job_id == job_id)
+            pthread_cond_wait(&e->_pool_start, &e->_pool_lock);
+        if (e->_pool_quit)
+            break;
+        job_id = e->_job_id;
+
+        // first _job.workers workers to wake up take part in the job,
+        // the rest isn't needed
+        if (e->_job.joined >= e->_job.workers)
+            continue;
+        ++e->_job.joined;
+
+        pthread_mutex_unlock(&e->_pool_lock);
+        e->_work();
+        pthread_mutex_lock(&e->_pool_lock);
+
+        if (--e->_job_running == 0)
+            pthread_cond_signal(&e->_pool_done);
+    }
+    pthread_mutex_unlock(&e->_pool_lock);
+
+    return NULL;
+}
+
+size_t RayEngine::_trace(const Ray *rays, size_t n, RayHit *out) const
+{
+    Vec3 dir, normal;
+    Scalar len;
+    double org[3], d[3];
+    ray_t r;
+    hit_t hit;
+    InstLeaf leaf;
+    size_t hits = 0;
+    int k;
+
+    leaf.insts = &_insts;
+
+    for (size_t i = 0; i < n; i++){
+        out[i] = RayHit();
+
+        dir = rays[i].to - rays[i].from;
+        len = dir.length();
+        if (isZero(len) || _root == -1)
+            continue;
+        dir /= len;
+
+        for (int a = 0; a < 3; a++){
+            org[a] = rays[i].from[a];
+            d[a] = dir[a];
+        }
+        rayInit(&r, org, d);
+
+        hit.t = len;
+        hit.packet = 0;
+        traverse(_nodes, _root, r, &hit, leaf);
+        if (!hit.packet)
+            continue;
+
+        // normal of hit triangle in world coordinates
+        k = hit.lane;
+        const tri4_t *p = hit.packet;
+        normal = Vec3(p->e1[1][k] * p->e2[2][k] - p->e1[2][k] * p->e2[1][k],
+                      p->e1[2][k] * p->e2[0][k] - p->e1[0][k] * p->e2[2][k],
+                      p->e1[0][k] * p->e2[1][k] - p->e1[1][k] * p->e2[0][k]);
+        normal = _insts[hit.inst].rot * normal;
+        normal.normalize();
+        if (normal * dir > 0.)
+            normal = -normal;
+
+        out[i].hit = true;
+        out[i].dist = hit.t;
+        out[i].point = rays[i].from + dir * (Scalar)hit.t;
+        out[i].normal = normal;
+        out[i].body = _insts[hit.inst].vis->body();
+        ++hits;
+    }
+
+    return hits;
+}
+
+void RayEngine::_rebuild()
+{
+    VisWorld *vw = _sim->visWorld();
+    std::list<VisBody *>::iterator it, it_end;
+    _vis_meshes_t vis_meshes;
+    std::vector<bprim_t> prims;
+    inst_t inst;
+    mesh_t *mesh;
+    bprim_t p;
+
+    _insts.clear();
+    _nodes.clear();
+    _root = -1;
+
+    it = vw->bodies().begin();
+    it_end = vw->bodies().end();
+    for (; it != it_end; ++it){
+        mesh = _mesh(*it);
+        vis_meshes[(*it)->id()] = mesh;
+        if (!mesh)
+            continue;
+
+        inst.vis = *it;
+        inst.mesh = mesh;
+        _updateInst(&inst);
+        _insts.push_back(inst);
+    }
+
+    // forget meshes of removed bodies (meshes itself are kept for reuse)
+    _vis_meshes.swap(vis_meshes);
+
+    for (size_t i = 0; i < _insts.size(); i++){
+        for (int a = 0; a < 3; a++){
+            p.min[a] = _insts[i].min[a];
+            p.max[a] = _insts[i].max[a];
+            p.c[a] = (p.min[a] + p.max[a]) * .5f;
+        }
+        p.idx = i;
+        prims.push_back(p);
+    }
+
+    if (prims.size() > 0){
+        InstBuilder builder(&_nodes);
+        _root = builder.build(&prims[0], prims.size());
+    }
+
+    _bodies_gen = vw->bodiesGen();
+}
+
+void RayEngine::_refit()
+{
+    bool moved = false;
+    int child;
+
+    for (size_t i = 0; i < _insts.size(); i++){
+        inst_t &inst = _insts[i];
+
+        inst.moved = false;
+        if (inst.pos != inst.vis->pos() || inst.rot != inst.vis->rot()){
+            box_t box;
+            for (int a = 0; a < 3; a++){
+                box.min[a] = inst.min[a];
+                box.max[a] = inst.max[a];
+            }
+
+            _updateInst(&inst);
+            moved = true;
+
+            for (int a = 0; a < 3; a++){
+                box.min[a] = std::min(box.min[a], inst.min[a]);
+                box.max[a] = std::max(box.max[a], inst.max[a]);
+            }
+            _moved.push_back(box);
+        }
+    }
+
+    if (!moved)
+        return;
+
+    // children are always stored after their parents so it is enough to
+    // walk nodes backwards
+    for (int i = (int)_nodes.size() - 1; i >= 0; i--){
+        node_t &n = _nodes[i];
+        for (int k = 0; k < 4; k++){
+            child = n.child[k];
+            if (child == -1)
+                continue;
+
+            for (int a = 0; a < 3; a++){
+                if (child <= -2){
+                    n.min[a][k] = _insts[-child - 2].min[a];
+                    n.max[a][k] = _insts[-child - 2].max[a];
+                }else{
+                    const node_t &c = _nodes[child];
+                    n.min[a][k] = FLT_MAX;
+                    n.max[a][k] = -FLT_MAX;
+                    for (int j = 0; j < 4; j++){
+                        if (c.child[j] == -1)
+                            continue;
+                        n.min[a][k] = std::min(n.min[a][k], c.min[a][j]);
+                        n.max[a][k] = std::max(n.max[a][k], c.max[a][j]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+RayEngine::mesh_t *RayEngine::_mesh(VisBody *vis)
+{
+    _vis_meshes_t::iterator it;
+    std::pair<_meshes_t::iterator, _meshes_t::iterator> range;
+    std::vector<float> tris;
+    unsigned long hash = 2166136261UL; // FNV-1a
+    const unsigned char *d;
+    mesh_t *mesh;
+
+    it = _vis_meshes.find(vis->id());
+    if (it != _vis_meshes.end())
+        return it->second;
+
+    if (!vis->node())
+        return 0;
+
+    TriCollector collector(&tris);
+    vis->node()->accept(collector);
+    if (tris.size() == 0)
+        return 0;
+
+    d = (const unsigned char *)&tris[0];
+    for (size_t i = 0; i < tris.size() * sizeof(float); i++){
+        hash = (hash ^ d[i]) * 16777619UL;
+    }
+
+    // bodies with same geometry share mesh
+    range = _meshes.equal_range(hash);
+    for (_meshes_t::iterator m = range.first; m != range.second; ++m){
+        if (m->second->tris == tris)
+            return m->second;
+    }
+
+    mesh = _buildMesh(tris);
+    mesh->hash = hash;
+    _meshes.insert(_meshes_t::value_type(hash, mesh));
+
+    return mesh;
+}
+
+RayEngine::mesh_t *RayEngine::_buildMesh(std::vector<float> &tris)
+{
+    mesh_t *mesh = new mesh_t;
+    std::vector<bprim_t> prims;
+    bprim_t p;
+    const float *v;
+
+    mesh->tris.swap(tris);
+
+    prims.resize(mesh->tris.size() / 9);
+    for (size_t i = 0; i < prims.size(); i++){
+        v = &mesh->tris[9 * i];
+        for (int a = 0; a < 3; a++){
+            p.min[a] = std::min(v[a], std::min(v[3 + a], v[6 + a]));
+            p.max[a] = std::max(v[a], std::max(v[3 + a], v[6 + a]));
+            p.c[a] = (p.min[a] + p.max[a]) * .5f;
+        }
+        p.idx = i;
+        prims[i] = p;
+    }
+
+    bprimBounds(&prims[0], prims.size(), mesh->min, mesh->max);
+
+    MeshBuilder builder(mesh);
+    mesh->root = builder.build(&prims[0], prims.size());
+
+    return mesh;
+}
+
+void RayEngine::_updateInst(inst_t *inst)
+{
+    Quat inv;
+    Vec3 c, col, center, ext;
+    Scalar w[3][3];
+
+    inst->pos = inst->vis->pos();
+    inst->rot = inst->vis->rot();
+    inst->moved = true;
+
+    // columns of rotation from world to local coordinates
+    inv = inst->rot.inverse();
+    for (int j = 0; j < 3; j++){
+        c.set(0., 0., 0.);
+        c[j] = 1.;
+        col = inv * c;
+        for (int i = 0; i < 3; i++)
+            inst->to_local[i][j] = col[i];
+
+        col = inst->rot * c;
+        for (int i = 0; i < 3; i++)
+            w[i][j] = col[i];
+    }
+
+    // bounding box in world coordinates
+    for (int a = 0; a < 3; a++){
+        center[a] = (inst->mesh->min[a] + inst->mesh->max[a]) * .5;
+        ext[a] = (inst->mesh->max[a] - inst->mesh->min[a]) * .5;
+    }
+    center = inst->rot * center + inst->pos;
+    for (int i = 0; i < 3; i++){
+        Scalar e = fabs(w[i][0]) * ext[0] + fabs(w[i][1]) * ext[1] + fabs(w[i][2]) * ext[2];
+        inst->min[i] = center[i] - e;
+        inst->max[i] = center[i] + e;
+    }
+}
+
+} /* namespace sensor */
+
+} /* namespace sim */
@@ -0,0 +1,217 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_SENSOR_RAYENGINE_HPP_
+#define _SIM_SENSOR_RAYENGINE_HPP_
+
+#include <vector>
+#include <map>
+#include <pthread.h>
+#include <sim/sim.hpp>
+
+namespace sim {
+
+namespace sensor {
+
+/**
+ * Ray tracing engine used by range finders.
+ *
+ * Triangles of all bodies in VisWorld are organized in two-level bounding
+ * volume hierarchy (4-ary BVH). Each distinct mesh gets its own hierarchy
+ * built only once in local coordinates of body, top level hierarchy over
+ * bodies is refitted once per step according to current positions of
+ * bodies and it is rebuilt only when bodies are added or removed.
+ * Ray is intersected with four boxes or four triangles at once (using SSE
+ * if available).
+ *
+ * Engine is shared by all sensors of one simulation, use RayEngine::get()
+ * to obtain it. If simulation has no VisWorld, rays are traced by
+ * World::castRays() instead.
+ */
+class RayEngine : public sim::Component {
+  public:
+    /**
+     * Node of BVH. Children are stored in "structure of arrays" layout so
+     * that all four boxes can be tested at once.
+     * Child with index >= 0 is inner node, -1 is empty and index <= -2
+     * refers to leaf (-index - 2 is index of triangle packet in meshes and
+     * index of instance in top level hierarchy).
+     */
+    struct node_t {
+        float min[3][4];
+        float max[3][4];
+        int child[4];
+    };
+
+    /**
+     * Packet of four triangles (vertex and two edges).
+     */
+    struct tri4_t {
+        float v0[3][4];
+        float e1[3][4];
+        float e2[3][4];
+    };
+
+    /**
+     * Triangular mesh with its own hierarchy.
+     */
+    struct mesh_t {
+        std::vector<float> tris; //!< Triangles (9 floats per triangle)
+        std::vector<node_t> nodes;
+        std::vector<tri4_t> packets;
+        int root;
+        float min[3], max[3]; //!< Bounding box
+        unsigned long hash;
+    };
+
+    /**
+     * Instance of mesh placed in world.
+     */
+    struct inst_t {
+        VisBody *vis;
+        mesh_t *mesh;
+        Vec3 pos;
+        Quat rot;
+        double to_local[3][3]; //!< Rotation from world to local coordinates
+        float min[3], max[3]; //!< Bounding box in world coordinates
+        bool moved; //!< True if body moved in last update
+    };
+
+    /**
+     * Axis aligned box.
+     */
+    struct box_t {
+        float min[3], max[3];
+    };
+
+  protected:
+    typedef std::map<unsigned long, mesh_t *> _vis_meshes_t;
+    typedef std::multimap<unsigned long, mesh_t *> _meshes_t;
+
+    _vis_meshes_t _vis_meshes; //!< VisBody's ID -> mesh
+    _meshes_t _meshes; //!< All meshes keyed by hash
+
+    std::vector<inst_t> _insts;
+    std::vector<node_t> _nodes; //!< Top level hierarchy
+    int _root;
+
+    unsigned long _bodies_gen; //!< Generation of bodies in VisWorld
+    bool _updated; //!< True if engine was updated at least once
+    Time _updated_time; //!< Simulated time of last update
+    bool _rebuilt; //!< True if last update rebuilt hierarchy
+    std::vector<box_t> _moved; //!< Boxes swept by bodies moved in last
+                               //!< update (union of old and new bounds)
+
+    /**
+     * Batch of rays traced by worker pool. Rays are taken by chunks.
+     */
+    struct job_t {
+        const Ray *rays;
+        RayHit *out;
+        size_t len;
+        size_t next; //!< First ray not taken yet
+        size_t hits; //!< Number of hits
+        size_t workers; //!< Number of workers taking part
+        size_t joined; //!< Number of workers that already joined
+    } _job;
+
+    std::vector<pthread_t> _workers; //!< Worker threads (created lazily)
+    pthread_mutex_t _pool_lock;
+    pthread_cond_t _pool_start; //!< Signals new job
+    pthread_cond_t _pool_done; //!< Signals finished job
+    unsigned long _job_id; //!< Incremented with each job
+    size_t _job_running; //!< Number of workers still working on job
+    bool _pool_quit;
+
+  public:
+    RayEngine();
+    ~RayEngine();
+
+    /**
+     * Returns engine of given simulation. New one is created and added
+     * into simulation if there is none.
+     */
+    static RayEngine *get(sim::Sim *sim);
+
+    void init(sim::Sim *sim);
+
+    /**
+     * Brings engine up to date with current state of VisWorld.
+     * Is done only once per simulation step, further calls in same step
+     * do nothing.
+     */
+    void update();
+
+    /**
+     * Traces n rays and stores closest hit of each into out array.
+     * Returns number of rays that hit something.
+     * Engine is updated first if needed.
+     */
+    size_t trace(const Ray *rays, size_t n, RayHit *out);
+
+    /**
+     * Same as trace() but rays are split among given number of threads
+     * (calling thread included). Worker threads are created on first use
+     * and kept for further calls.
+     */
+    size_t trace(const Ray *rays, size_t n, RayHit *out, size_t threads);
+
+    /**
+     * Returns true if anything inside given box could have changed in last
+     * update, i.e., if some body overlapping the box (before or after
+     * update) moved or if bodies were added or removed.
+     * Engine is updated first if needed.
+     */
+    bool changed(const Vec3 &min, const Vec3 &max);
+
+    size_t numBodies() const { return _insts.size(); }
+    size_t numMeshes() const { return _meshes.size(); }
+
+  protected:
+    void _rebuild();
+    void _refit();
+
+    /**
+     * Traces rays without updating engine, can be called from more
+     * threads at once.
+     */
+    size_t _trace(const Ray *rays, size_t n, RayHit *out) const;
+
+    /**
+     * Returns mesh of VisBody (cached).
+     */
+    mesh_t *_mesh(VisBody *vis);
+    mesh_t *_buildMesh(std::vector<float> &tris);
+
+    void _updateInst(inst_t *inst);
+
+    /**
+     * Traces chunks of current job until there are none left.
+     */
+    void _work();
+    static void *_workerThread(void *);
+};
+
+} /* namespace sensor */
+
+} /* namespace sim */
+
+#endif /* _SIM_SENSOR_RAYENGINE_HPP_ */
@@ -0,0 +1,140 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <osg/Version>
+#if OSG_MIN_VERSION_REQUIRED(3, 4, 0)
+# include <osg/GLExtensions>
+#else
+# include <osg/BufferObject>
+#endif
+
+#include "readback.hpp"
+#include <sim/msg.hpp>
+
+namespace sim {
+namespace sensor {
+
+#if OSG_MIN_VERSION_REQUIRED(3, 4, 0)
+typedef osg::GLExtensions gl_ext_t;
+static gl_ext_t *glExt(osg::State *state)
+    { return state->get<osg::GLExtensions>(); }
+#else
+typedef osg::GLBufferObject::Extensions gl_ext_t;
+static gl_ext_t *glExt(osg::State *state)
+    { return osg::GLBufferObject::getExtensions(state->getContextID(), true); }
+#endif
+
+TextureReadback::TextureReadback(osg::Texture2D *tex, int width, int height)
+    : _tex(tex), _width(width), _height(height),
+      _format(GL_RGBA), _type(GL_UNSIGNED_BYTE), _components(4),
+      _context(0), _idx(0), _frames(0), _realloc(true)
+{
+    _pbo[0] = _pbo[1] = 0;
+}
+
+void TextureReadback::setTexture(osg::Texture2D *tex, int width, int height)
+{
+    _tex = tex;
+    _width = width;
+    _height = height;
+    _realloc = true;
+}
+
+void TextureReadback::setFormat(GLenum format, GLenum type, int bytes)
+{
+    _format = format;
+    _type = type;
+    _components = bytes;
+    _realloc = true;
+}
+
+void TextureReadback::operator()(osg::RenderInfo &info) const
+{
+    osg::State *state = info.getState();
+    gl_ext_t *ext = glExt(state);
+    GLsizeiptr size = _width * _height * _components;
+    const void *data;
+    GLint align;
+
+    if (!_tex)
+        return;
+
+    // buffers of other context can't be used
+    if (_pbo[0] && _context != state->getContextID()){
+        _pbo[0] = _pbo[1] = 0;
+        _realloc = true;
+    }
+
+    if (_realloc){
+        if (!_pbo[0]){
+            ext->glGenBuffers(2, _pbo);
+            _context = state->getContextID();
+        }
+
+        for (int i = 0; i < 2; i++){
+            ext->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, _pbo[i]);
+            ext->glBufferData(GL_PIXEL_PACK_BUFFER_ARB, size, 0,
+                              GL_STREAM_READ_ARB);
+        }
+
+        _frames = 0;
+        _realloc = false;
+    }
+
+    // start transfer of current frame
+    state->applyTextureAttribute(0, _tex);
+    ext->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, _pbo[_idx]);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &align);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, _format, _type, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, align);
+
+    // previous frame is transfered by now
+    if (_frames > 0){
+        ext->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, _pbo[1 - _idx]);
+        data = ext->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+        if (data){
+            _ready((const unsigned char *)data);
+            ext->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+        }else{
+            ERR("Can't map pixel buffer.");
+        }
+    }
+
+    ext->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+    _idx = 1 - _idx;
+    ++_frames;
+}
+
+void TextureReadback::releaseGLObjects(osg::State *state) const
+{
+    // without state buffers are freed together with context
+    if (state && _pbo[0] && _context == state->getContextID())
+        glExt(state)->glDeleteBuffers(2, _pbo);
+
+    _pbo[0] = _pbo[1] = 0;
+    _realloc = true;
+}
+
+} /* namespace sensor */
+
+} /* namespace sim */
@@ -0,0 +1,90 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_SENSOR_READBACK_HPP_
+#define _SIM_SENSOR_READBACK_HPP_
+
+#include <osg/Camera>
+#include <osg/Texture2D>
+
+namespace sim {
+
+namespace sensor {
+
+/**
+ * Asynchronous read of texture content into memory.
+ *
+ * Callback should be set as final draw callback of camera that renders
+ * into texture. Each frame texture is copied into one of two pixel buffer
+ * objects and the other one, filled in previous frame, is mapped and
+ * handed to _ready(). So rendering never waits for transfer of pixels
+ * and data of frame N are available while frame N+1 is rendered.
+ */
+class TextureReadback : public osg::Camera::DrawCallback {
+  protected:
+    osg::Texture2D *_tex;
+    int _width, _height;
+    GLenum _format; /*!< Pixel format of read data (default GL_RGBA) */
+    GLenum _type; /*!< Data type of read data (default GL_UNSIGNED_BYTE) */
+    int _components; /*!< Number of bytes per pixel */
+
+    mutable GLuint _pbo[2];
+    mutable unsigned int _context; /*!< ID of GL context owning _pbo */
+    mutable int _idx; /*!< PBO filled in current frame */
+    mutable unsigned long _frames; /*!< Frames read into current PBOs */
+    mutable bool _realloc; /*!< True if PBOs must be (re)allocated */
+
+  public:
+    TextureReadback(osg::Texture2D *tex, int width, int height);
+
+    /**
+     * Changes texture that is read. Must not be called during rendering.
+     */
+    void setTexture(osg::Texture2D *tex, int width, int height);
+
+    /**
+     * Sets pixel format (GL_RGBA, GL_RGB, GL_BGR, GL_LUMINANCE,
+     * GL_DEPTH_COMPONENT, ...), data type and number of bytes per pixel
+     * data are read in, conversion is done by GL.
+     * Must not be called during rendering.
+     */
+    void setFormat(GLenum format, GLenum type, int bytes);
+
+    void operator()(osg::RenderInfo &info) const;
+
+    /**
+     * Deletes pixel buffer objects. Called by OSG when GL context of
+     * camera is released.
+     */
+    virtual void releaseGLObjects(osg::State *state = 0) const;
+
+  protected:
+    /**
+     * Called with data of previous frame.
+     */
+    virtual void _ready(const unsigned char *data) const = 0;
+};
+
+} /* namespace sensor */
+
+} /* namespace sim */
+
+#endif /* _SIM_SENSOR_READBACK_HPP_ */
@@ -0,0 +1,188 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include "sensorhub.hpp"
+#include "sim/msg.hpp"
+
+namespace sim {
+namespace sensor {
+
+SensorHub::SensorHub(size_t threads)
+    : sim::Component(),
+      _sim(0), _engine(0), _threads(threads)
+{
+}
+
+SensorHub::~SensorHub()
+{
+    // range finders can outlive hub
+    for_each(std::list<RangeFinder *>::iterator, _rfs){
+        _release(*it);
+        (*it)->_hub = 0;
+    }
+}
+
+void SensorHub::init(sim::Sim *sim)
+{
+    _sim = sim;
+    _engine = RayEngine::get(_sim);
+
+    _sim->regPreStep(this);
+}
+
+void SensorHub::cbPreStep()
+{
+    size_t i, off, from;
+    bool any = false;
+
+    if (_rays.size() == 0)
+        return;
+
+    i = 0;
+    for_each(std::list<RangeFinder *>::iterator, _rfs){
+        _dirty[i] = (*it)->_needsTrace();
+        any = any || _dirty[i];
+        ++i;
+    }
+
+    if (!any)
+        return;
+
+    // trace runs of consecutive range finders that need it (whole batch
+    // at once if all of them do)
+    i = off = from = 0;
+    for_each(std::list<RangeFinder *>::iterator, _rfs){
+        if (!_dirty[i]){
+            if (from < off)
+                _engine->trace(&_rays[from], off - from, &_hits[from], _threads);
+            from = off + (*it)->_num_beams;
+        }
+
+        off += (*it)->_num_beams;
+        ++i;
+    }
+    if (from < off)
+        _engine->trace(&_rays[from], off - from, &_hits[from], _threads);
+
+    i = 0;
+    for_each(std::list<RangeFinder *>::iterator, _rfs){
+        if (_dirty[i])
+            (*it)->_updateData();
+        ++i;
+    }
+}
+
+void SensorHub::addRangeFinder(RangeFinder *rf)
+{
+    _rfs.push_back(rf);
+    _layout();
+}
+
+void SensorHub::rmRangeFinder(RangeFinder *rf)
+{
+    std::list<RangeFinder *>::iterator it;
+
+    it = std::find(_rfs.begin(), _rfs.end(), rf);
+    if (it == _rfs.end())
+        return;
+
+    _release(rf);
+    _rfs.erase(it);
+
+    // beams of remaining range finders are moved into new arrays
+    _layout();
+}
+
+void SensorHub::_release(RangeFinder *rf)
+{
+    Ray *rays;
+    RayHit *hits;
+
+    if (rf->_own_beams)
+        return;
+
+    rays = new Ray[rf->_num_beams];
+    hits = new RayHit[rf->_num_beams];
+    for (size_t i = 0; i < rf->_num_beams; i++){
+        rays[i] = rf->_rays[i];
+        hits[i] = rf->_hits[i];
+    }
+
+    rf->_rays = rays;
+    rf->_hits = hits;
+    rf->_own_beams = true;
+}
+
+void SensorHub::_layout()
+{
+    std::vector<Ray> rays;
+    std::vector<RayHit> hits;
+    size_t len, off;
+    RangeFinder *rf;
+
+    len = 0;
+    for_each(std::list<RangeFinder *>::iterator, _rfs){
+        len += (*it)->_num_beams;
+    }
+
+    rays.resize(len);
+    hits.resize(len);
+
+    off = 0;
+    for_each(std::list<RangeFinder *>::iterator, _rfs){
+        rf = *it;
+
+        // keep beams already computed (static range finders compute them
+        // only once)
+        for (size_t i = 0; i < rf->_num_beams; i++){
+            rays[off + i] = rf->_rays[i];
+            hits[off + i] = rf->_hits[i];
+        }
+
+        if (rf->_own_beams){
+            delete [] rf->_rays;
+            delete [] rf->_hits;
+            rf->_own_beams = false;
+        }
+
+        off += rf->_num_beams;
+    }
+
+    _rays.swap(rays);
+    _hits.swap(hits);
+    _dirty.resize(_rfs.size());
+
+    off = 0;
+    for_each(std::list<RangeFinder *>::iterator, _rfs){
+        rf = *it;
+        rf->_rays = &_rays[off];
+        rf->_hits = &_hits[off];
+        off += rf->_num_beams;
+    }
+
+    DBG("Sensor hub: " << _rfs.size() << " range finders, "
+        << _rays.size() << " beams");
+}
+
+} /* namespace sensor */
+
+} /* namespace sim */
@@ -0,0 +1,97 @@
+/***
+ * sim
+ * ---------------------------------
+ * Copyright (c)2010 Daniel Fiser <danfis@danfis.cz>
+ *
+ *  This file is part of sim.
+ *
+ *  sim is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  sim is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_SENSOR_SENSORHUB_HPP_
+#define _SIM_SENSOR_SENSORHUB_HPP_
+
+#include <list>
+#include <vector>
+#include <sim/sim.hpp>
+#include <sim/sensor/rayengine.hpp>
+#include <sim/sensor/rangefinder.hpp>
+
+namespace sim {
+
+namespace sensor {
+
+/**
+ * Traces beams of all registered range finders in one batch per step.
+ *
+ * Beams of all range finders are kept in one contiguous array owned by
+ * hub, range finders only write their beams into it and read their hits
+ * from it. Range finder is registered in hub by RangeFinder::setHub().
+ * Range finders whose scan can be reused from previous step are skipped.
+ */
+class SensorHub : public sim::Component {
+  protected:
+    sim::Sim *_sim;
+    RayEngine *_engine;
+    size_t _threads; //!< Number of threads used for tracing
+
+    std::list<RangeFinder *> _rfs; //!< Registered range finders
+    std::vector<Ray> _rays; //!< Beams of all range finders
+    std::vector<RayHit> _hits; //!< Hits of all beams
+    std::vector<bool> _dirty; //!< Range finders that must be traced
+
+  public:
+    SensorHub(size_t threads = 1);
+    ~SensorHub();
+
+    /**
+     * Sets number of threads used for tracing batch of beams.
+     */
+    void setNumThreads(size_t threads) { _threads = threads; }
+    size_t numThreads() const { return _threads; }
+
+    size_t numRangeFinders() const { return _rfs.size(); }
+    size_t numBeams() const { return _rays.size(); }
+
+    void init(sim::Sim *sim);
+    void cbPreStep();
+
+    /**
+     * Registers range finder. Called from RangeFinder::init().
+     */
+    void addRangeFinder(RangeFinder *rf);
+
+    /**
+     * Unregisters range finder, the range finder gets back its own copy
+     * of beams. Called from ~RangeFinder().
+     */
+    void rmRangeFinder(RangeFinder *rf);
+
+  protected:
+    /**
+     * Reallocates arrays of beams and lets range finders point into them.
+     */
+    void _layout();
+
+    /**
+     * Gives range finder its own copy of its beams.
+     */
+    void _release(RangeFinder *rf);
+};
+
+} /* namespace sensor */
+
+} /* namespace sim */
+
+#endif /* _SIM_SENSOR_SENSORHUB_HPP_ */
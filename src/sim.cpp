@@ -178,6 +178,7 @@ void SimComponentMessageRegistry::deliverAssignedMessages(Component *c,
 
 Sim::Sim(World *world, VisWorld *visworld, bool enable_vis_world)
     : _world(world), _visworld(visworld), _enable_vis_world(enable_vis_world),
+      _headless(false),
       _in_cb(false),
       _time_step(0, 20000000), _time_substeps(10),
       _vis_time_step(0, 50000000),
@@ -247,8 +248,15 @@ void Sim::init()
 {
     if (_world)
         _world->init();
-    if (_visworld)
+    if (_visworld){
+        if (_headless)
+            _visworld->setHeadless(true);
         _visworld->init();
+
+        // VisWorld falls back to window if offscreen rendering can't be
+        // set up
+        _headless = _visworld->headless();
+    }
     if (_visworld && _visworld->window() && _visworld->viewMain()){
         DBG("");
         _visworld->viewMain()->addEventHandler(new SimKeyboard(this));
@@ -317,6 +325,10 @@ void *Sim::_worldStepsThread(void *_sim)
         if (sim->_simulate){
             sim->_stepWorld();
 
+            // in headless mode cameras are rendered in lockstep with World
+            if (sim->_headless)
+                sim->_stepVisWorld();
+
             std::cerr << sim->timeReal() << " / " << sim->timeSimulated() << "\r";
 
             // Try to align simulated time with real time.
@@ -354,14 +366,14 @@ void *Sim::_visWorldStepsThread(void *_sim)
 void Sim::_runStepThreads()
 {
     pthread_create(&_th_step_world, NULL, _worldStepsThread, this);
-    if (_enable_vis_world && _visworld)
+    if (_enable_vis_world && _visworld && !_headless)
         pthread_create(&_th_step_visworld, NULL, _visWorldStepsThread, this);
 }
 
 void Sim::_joinStepThreads()
 {
     pthread_join(_th_step_world, NULL);
-    if (_enable_vis_world && _visworld)
+    if (_enable_vis_world && _visworld && !_headless)
         pthread_join(_th_step_visworld, NULL);
 }
 
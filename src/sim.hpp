@@ -107,6 +107,7 @@ class Sim {
     pthread_t _th_step_world; //!< Thread for World's steps
     pthread_t _th_step_visworld; //!< Thread for VisWorld's steps
     bool _enable_vis_world;
+    bool _headless; //!< True if VisWorld renders offscreen in lockstep
 
     std::list<Component *> _cs; //!< List of all components
     std::list<Component *> _cs_uninit; //!< List of uninitialized components
@@ -162,6 +163,16 @@ class Sim {
     void setWorld(World *w);
     void setVisWorld(VisWorld *w);
 
+    /**
+     * Enables headless mode: VisWorld opens no window and renders only
+     * sensor cameras offscreen (see VisWorld::setHeadless()). Frame is
+     * rendered after each step of World so cameras are in sync with
+     * simulated time even if simulation runs faster than real time.
+     * Must be called before init().
+     */
+    void setHeadless(bool yes = true) { _headless = yes; }
+    bool headless() const { return _headless; }
+
     const Time &timeStep() const { return _time_step; }
     unsigned int timeSubSteps() const { return _time_substeps; }
     void setTimeStep(const Time &t) { _time_step = t; }
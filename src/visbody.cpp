@@ -74,7 +74,7 @@ static void printBlenderMaterial(std::ostream &ofs, const osg::Vec4 &color, cons
 }
 
 VisBody::VisBody()
-    : _id(_getUniqueID()), _node(0), _offset(0., 0., 0.)
+    : _id(_getUniqueID()), _node(0), _offset(0., 0., 0.), _body(0)
 {
     _root = new osg::PositionAttitudeTransform();
     _group = new osg::Group();
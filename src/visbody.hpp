@@ -33,6 +33,7 @@
 
 namespace sim {
 
+class Body;
 
 /**
  * Visual representation of body.
@@ -45,6 +46,7 @@ class VisBody {
     osg::ref_ptr<osg::Geode> _text;
     osg::ref_ptr<osg::Node> _node;
     Vec3 _offset;
+    Body *_body; //!< Body this is representation of (can be NULL)
 
   public:
     /**
@@ -75,6 +77,13 @@ class VisBody {
     osg::Node *node() { return _node; }
     const osg::Node *node() const { return _node; }
 
+    /**
+     * Returns body this visual representation belongs to (set by body
+     * when it is activated), or NULL.
+     */
+    Body *body() const { return _body; }
+    void setBody(Body *b) { _body = b; }
+
     /**
      * Returns position of root node.
      */
@@ -37,7 +37,8 @@ namespace sim {
 //VisBody *a1,*a2,*a3;
 
 VisWorld::VisWorld()
-    : _window(true)
+    : _bodies_gen(0), _window(true),
+      _headless(false), _headless_width(64), _headless_height(64)
 {
     _viewer = new osgViewer::CompositeViewer();
     _view_main = new osgViewer::View;
@@ -82,6 +83,7 @@ void VisWorld::addBody(VisBody *obj)
 
     _g_bodies->addChild(n);
     _bodies.push_back(obj);
+    ++_bodies_gen;
 }
 
 
@@ -93,14 +95,16 @@ void VisWorld::rmBody(VisBody *obj)
 
     _g_bodies->removeChild(n);
     _bodies.remove(obj);
+    ++_bodies_gen;
 }
 
-void VisWorld::addCam(osg::Camera *cam)
+void VisWorld::addCam(osg::Camera *cam, bool with_scene)
 {
     DBG("_cams: " << _cams);
     if (!_cams->containsNode(cam)){
         _cams->addChild(cam);
-        cam->addChild(_root_vis);
+        if (with_scene)
+            cam->addChild(_root_vis);
     }
 }
 
@@ -138,7 +142,11 @@ void VisWorld::init()
 {
     _view_main->setSceneData(_root);
 
-    if (_window){
+    // window is used if offscreen rendering can't be set up
+    if (_headless && !_setUpHeadless())
+        _headless = false;
+
+    if (!_headless && _window){
         if (!_view_main->getCameraManipulator()){
             //_viewer->setCameraManipulator(new osgGA::TrackballManipulator());
             _view_main->setCameraManipulator(new VisWorldManip());
@@ -167,7 +175,7 @@ void VisWorld::finish()
 
 void VisWorld::step()
 {
-    if (_window){
+    if (_window || _headless){
         _viewer->frame(0.);
     }
 }
@@ -178,6 +186,44 @@ bool VisWorld::done()
 }
 
 
+bool VisWorld::_setUpHeadless()
+{
+    osg::ref_ptr<osg::GraphicsContext::Traits> traits;
+    osg::ref_ptr<osg::GraphicsContext> gc;
+    osg::Camera *cam;
+
+    traits = new osg::GraphicsContext::Traits;
+    traits->readDISPLAY();
+    traits->setUndefinedScreenDetailsToDefaultScreen();
+    traits->x = 0;
+    traits->y = 0;
+    traits->width = _headless_width;
+    traits->height = _headless_height;
+    traits->windowDecoration = false;
+    traits->doubleBuffer = false;
+    traits->sharedContext = 0;
+    traits->pbuffer = true;
+
+    gc = osg::GraphicsContext::createGraphicsContext(traits.get());
+    if (!gc.valid()){
+        ERR("Can't create pbuffer for headless rendering.");
+        return false;
+    }
+
+    // main camera renders only offscreen cameras and doesn't even clear
+    // its own buffer
+    cam = _view_main->getCamera();
+    cam->setGraphicsContext(gc.get());
+    cam->setViewport(0, 0, _headless_width, _headless_height);
+    cam->setClearMask(0);
+    _view_main->setSceneData(_cams);
+
+    DBG("Headless rendering into " << _headless_width << "x"
+        << _headless_height << " pbuffer");
+
+    return true;
+}
+
 void VisWorld::_setUpLights()
 {
     osg::ref_ptr<osg::Light> light;
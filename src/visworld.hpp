@@ -56,8 +56,11 @@ class VisWorld {
     osg::ref_ptr<osg::Group> _off_scene;
 
     std::list<VisBody *> _bodies;
+    unsigned long _bodies_gen; /*!< Incremented on each change of _bodies */
 
     bool _window; /*!< Show a window? */
+    bool _headless; /*!< Render offscreen only sensor cameras? */
+    int _headless_width, _headless_height; /*!< Size of pbuffer */
 
   public:
     VisWorld();
@@ -70,9 +73,27 @@ class VisWorld {
     bool window() const { return _window; }
     void setWindow(bool yes = true) { _window = yes; }
 
+    /**
+     * Enables headless rendering. No window is opened, scene is rendered
+     * into pbuffer of given size and only offscreen cameras (see addCam())
+     * are rendered - main view draws nothing.
+     * Pbuffer is created by windowing system OSG was built with, i.e., GLX
+     * needs some X server (e.g., Xvfb) while EGL or OSMesa builds of OSG
+     * need no display at all.
+     * Must be called before init().
+     */
+    void setHeadless(bool yes = true, int width = 64, int height = 64)
+        { _headless = yes; _headless_width = width; _headless_height = height; }
+    bool headless() const { return _headless; }
+
     const std::list<VisBody *> &bodies() const { return _bodies; }
     std::list<VisBody *> &bodies() { return _bodies; }
 
+    /**
+     * Returns number that changes whenever body is added or removed.
+     */
+    unsigned long bodiesGen() const { return _bodies_gen; }
+
     /**
      * Returns root of scene graph.
      */
@@ -87,7 +108,11 @@ class VisWorld {
     void addView(osgViewer::View *view);
     void rmView(osgViewer::View *view);
 
-    void addCam(osg::Camera *cam);
+    /**
+     * Adds offscreen camera. If with_scene is true the camera renders
+     * whole scene, otherwise it renders only its own children.
+     */
+    void addCam(osg::Camera *cam, bool with_scene = true);
     void rmCam(osg::Camera *cam);
 
     void addOffScene(osg::Node *n);
@@ -122,6 +147,11 @@ class VisWorld {
 
     void _createCoordFrame();
 
+    /**
+     * Sets up main view to render offscreen cameras into pbuffer.
+     */
+    bool _setUpHeadless();
+
 };
 
 }
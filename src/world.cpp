@@ -20,9 +20,101 @@
  */
 
 
+#include <set>
 #include <sim/world.hpp>
 
 namespace sim {
+
+struct __query_t {
+    WorldQueryCallback cb;
+    void *data;
+    bool sphere;
+    Vec3 center;
+    Scalar radius2;
+    std::set<Body *> found;
+};
+
+static void __queryShape(Body *body, const Vec3 &min, const Vec3 &max, void *data)
+{
+    __query_t *q = (__query_t *)data;
+    Scalar d, dist2 = 0.;
+
+    if (!body)
+        return;
+
+    if (q->sphere){
+        // squared distance between center of sphere and box
+        for (int i = 0; i < 3; i++){
+            if (q->center[i] < min[i]){
+                d = min[i] - q->center[i];
+                dist2 += d * d;
+            }else if (q->center[i] > max[i]){
+                d = q->center[i] - max[i];
+                dist2 += d * d;
+            }
+        }
+
+        if (dist2 > q->radius2)
+            return;
+    }
+
+    if (q->found.insert(body).second)
+        q->cb(body, q->data);
+}
+
+static void __queryList(Body *body, void *data)
+{
+    std::list<Body *> *bodies = (std::list<Body *> *)data;
+    bodies->push_back(body);
+}
+
+
+size_t World::castRays(const Ray *rays, size_t n, RayHit *out)
+{
+    // no collision geometry available
+    for (size_t i = 0; i < n; i++){
+        out[i] = RayHit();
+    }
+    return 0;
+}
+
+void World::queryAABB(const Vec3 &min, const Vec3 &max,
+                      WorldQueryCallback cb, void *data)
+{
+    __query_t q;
+
+    q.cb = cb;
+    q.data = data;
+    q.sphere = false;
+
+    _queryAABB(min, max, __queryShape, &q);
+}
+
+void World::querySphere(const Vec3 &center, Scalar radius,
+                        WorldQueryCallback cb, void *data)
+{
+    __query_t q;
+    Vec3 r(radius, radius, radius);
+
+    q.cb = cb;
+    q.data = data;
+    q.sphere = true;
+    q.center = center;
+    q.radius2 = radius * radius;
+
+    _queryAABB(center - r, center + r, __queryShape, &q);
+}
+
+void World::queryAABB(const Vec3 &min, const Vec3 &max, std::list<Body *> *bodies)
+{
+    queryAABB(min, max, __queryList, (void *)bodies);
+}
+
+void World::querySphere(const Vec3 &center, Scalar radius, std::list<Body *> *bodies)
+{
+    querySphere(center, radius, __queryList, (void *)bodies);
+}
+
 #ifndef SIM_HAVE_ODE
 WorldODE *ODE()
 {
@@ -31,11 +31,47 @@
 
 namespace sim {
 
+/**
+ * Ray (line segment) used for ray casting.
+ */
+struct Ray {
+    Vec3 from; //!< Starting point of ray
+    Vec3 to;   //!< End point of ray
+
+    Ray() {}
+    Ray(const Vec3 &f, const Vec3 &t) : from(f), to(t) {}
+};
+
+/**
+ * Result of ray cast - the closest hit along the ray.
+ */
+struct RayHit {
+    bool hit;      //!< True if ray hit something
+    Scalar dist;   //!< Distance from starting point of ray
+    Vec3 point;    //!< Point of hit in world coordinates
+    Vec3 normal;   //!< Normal of hit surface
+    Body *body;    //!< Body that was hit (can be NULL)
+
+    RayHit() : hit(false), dist(0.), body(0) {}
+};
+
+/**
+ * Callback used by spatial queries (see World::queryAABB()).
+ */
+typedef void (*WorldQueryCallback)(Body *body, void *data);
 
 /**
  * Physical representation world.
  */
 class World {
+  public:
+    /**
+     * Callback used by backend part of spatial queries. Arguments are
+     * body and axis aligned bounding box of one of its shapes.
+     */
+    typedef void (*_query_cb_t)(Body *body, const Vec3 &min, const Vec3 &max,
+                                void *data);
+
   protected:
     VisWorld *_vis; //!< Reference to visual representation
 
@@ -105,6 +141,60 @@ class World {
                                      const Vec3 &axis1, const Vec3 &axis2)
         { return 0; }
     /* \} */
+
+    /* \{ */
+    /**
+     * Casts n rays against collision geometry of world and stores closest
+     * hit of each ray into out array (which must have room for n hits).
+     * Returns number of rays that hit something.
+     *
+     * No visual representation is needed, so this works also in headless
+     * runs.
+     */
+    virtual size_t castRays(const Ray *rays, size_t n, RayHit *out);
+
+    /**
+     * Casts single ray, returns true if it hit something.
+     */
+    bool castRay(const Ray &ray, RayHit *out)
+        { return castRays(&ray, 1, out) == 1; }
+    /* \} */
+
+    /* \{ */
+    /**
+     * Calls cb once for each body whose bounding box overlaps axis aligned
+     * box given by min and max corners.
+     * Broadphase of physics engine is used where possible: Bullet walks
+     * its dynamic AABB tree (O(log n)), while ODE's hash space doesn't use
+     * its grid for a single geom, so ODE query is linear sweep over
+     * bounding boxes of all geoms (O(n)).
+     */
+    void queryAABB(const Vec3 &min, const Vec3 &max,
+                   WorldQueryCallback cb, void *data);
+
+    /**
+     * Same as queryAABB() but calls cb for bodies whose bounding box
+     * overlaps sphere.
+     */
+    void querySphere(const Vec3 &center, Scalar radius,
+                     WorldQueryCallback cb, void *data);
+
+    /**
+     * Same as above but found bodies are appended to given list.
+     */
+    void queryAABB(const Vec3 &min, const Vec3 &max, std::list<Body *> *bodies);
+    void querySphere(const Vec3 &center, Scalar radius, std::list<Body *> *bodies);
+    /* \} */
+
+  protected:
+    /**
+     * Backend specific part of spatial queries.
+     * Calls cb for each shape whose bounding box overlaps given box. Body
+     * can be reported more times (once per each shape).
+     * Default implementation finds nothing.
+     */
+    virtual void _queryAABB(const Vec3 &min, const Vec3 &max,
+                            _query_cb_t cb, void *data) {}
 };
 
 class WorldODE : public World {
@@ -266,6 +356,41 @@ class WorldBullet : public World {
     WorldBullet() : World() {}
 
   public:
+    /* \{ */
+    /**
+     * Enables auto disabling (sleeping) of bodies. A body is put asleep
+     * when magnitudes of both its linear and angular velocity stay below
+     * given thresholds for given amount of simulation time (in seconds).
+     * Settings are applied to all already created bodies and also to
+     * newly created ones.
+     * Enabled by default with Bullet's defaults (0.8, 1.0, 2.0).
+     *
+     * Note that Bullet shares time-to-sleep among all worlds.
+     */
+    virtual void setAutoDisable(Scalar linear_treshold = 0.8, Scalar angular_treshold = 1.,
+                                Scalar time = 2.) = 0;
+    virtual void resetAutoDisable() = 0;
+    virtual bool autoDisable() const = 0;
+
+    /**
+     * Keeps body awake regardless of auto disabling settings.
+     * This is useful for bodies driven from outside (e.g., by a
+     * controller) which must never miss a step.
+     */
+    virtual void setBodyForceAwake(Body *b, bool yes = true) = 0;
+
+    /**
+     * Wakes body up or puts it asleep immediately.
+     * Body put asleep is woken up by the first contact or joint that
+     * needs it.
+     */
+    virtual void setBodyAwake(Body *b, bool awake = true) = 0;
+
+    /**
+     * Returns number of dynamic bodies that were awake in last step.
+     */
+    virtual size_t numActiveBodies() const = 0;
+    /* \} */
 };
 
 